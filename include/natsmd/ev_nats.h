@@ -4,6 +4,7 @@
 #include <raikv/ev_tcp.h>
 #include <raikv/ev_publish.h>
 #include <natsmd/nats_map.h>
+#include <natsmd/nats_proj.h>
 #include <raimd/md_msg.h>
 
 extern "C" {
@@ -15,6 +16,22 @@ rai::kv::EvTcpListen *nats_create_listener( rai::kv::EvPoll *p,
 namespace rai {
 namespace natsmd {
 
+/* CONNECT "encoding":"json|rv|tibmsg|raw", the format of the msgs delivered,
+ * binary msgs are converted with the raimd writer of the format; raw is
+ * last, the formats before it are the ones converted to */
+enum NatsEncoding {
+  NATS_ENC_JSON    = 0, /* the default, JsonMsgWriter */
+  NATS_ENC_RV      = 1, /* RvMsgWriter */
+  NATS_ENC_TIBMSG  = 2, /* TibMsgWriter */
+  NATS_ENC_RAW     = 3  /* as published, same as "binary":true */
+};
+static const uint8_t NATS_ENC_CONVERT = NATS_ENC_RAW; /* count converted */
+
+static inline const char *nats_encoding_name( uint8_t enc ) {
+  static const char *name[] = { "json", "rv", "tibmsg", "raw" };
+  return enc <= NATS_ENC_RAW ? name[ enc ] : "unknown";
+}
+
 struct NatsLogin {
   uint64_t stamp;         /* time of login */
   bool     verbose,       /* whether +OK is sent */
@@ -23,7 +40,11 @@ struct NatsLogin {
            echo,          /* whether to forward pubs to subs owned by client */
            headers,       /* */
            no_responders, /* */
-           binary;
+           binary,
+           conflate,      /* keep latest msg per subject when backpressured */
+           delta,         /* send json of the fields changed, with refresh */
+           sequence;      /* add Nats-Seq, Nats-Loss headers, with headers */
+  uint8_t  encoding;      /* NatsEncoding, binary is NATS_ENC_RAW */
   int      protocol;      /* == 1 */
   char   * name,          /* connect parameters user:"str" */
          * lang,          /*                    lang:"C" */
@@ -54,6 +75,100 @@ struct NatsLogin {
   }
 };
 
+struct NatsHotTrack;
+
+/* what happens when a connection has more than max_pending bytes queued */
+enum NatsSlowPolicy {
+  NATS_SLOW_STALL = 0, /* backpressure the publisher, the default */
+  NATS_SLOW_DROP  = 1, /* drop msgs to the connection and count them */
+  NATS_SLOW_CLOSE = 2  /* send -ERR 'Slow Consumer' and close */
+};
+
+/* totals of the connections accepted by a listener, the counters of a
+ * connection are added when it is closed */
+struct NatsListenStats {
+  uint64_t start_ns,   /* when listener was created */
+           accept_cnt, /* connections accepted */
+           close_cnt,  /* connections closed */
+           msgs_recv,  /* counters of closed connections */
+           msgs_sent,
+           bytes_recv,
+           bytes_sent,
+           slow_drops,  /* msgs dropped by NATS_SLOW_DROP */
+           slow_closes, /* connections closed by NATS_SLOW_CLOSE */
+           backpressure, /* pubs which backpressured the publisher */
+           converts,    /* msgs transformed to json */
+           zero_refs,   /* msgs appended by reference, not copied */
+           zero_ref_bytes, /* bytes of those msgs */
+           flush_timers, /* writes started by the flush timer */
+           read_calls,  /* EvConnection::read() calls */
+           write_calls; /* EvConnection::write() calls */
+  void zero( void ) {
+    ::memset( (void *) this, 0, sizeof( *this ) );
+  }
+};
+
+/* the result of the last NatsMsgTransform::transform(), a publish is
+ * delivered to each connection in turn, so the connections after the first
+ * use the result instead of unpacking and converting the msg again; the
+ * key is a copy of the msg bytes, the addresses of a publish are reused by
+ * the next one and a connection may skip a publish, so only the bytes tell
+ * that a msg is the same; the listener has one for each NatsEncoding */
+struct NatsXfCache {
+  uint32_t     msg_len,
+               msg_enc;
+  bool         ok;        /* if buf is the msg converted, or failed */
+  char       * buf,       /* converted msg */
+             * src;       /* msg_len bytes of the msg converted */
+  size_t       buf_len,
+               buf_size,
+               src_size;
+  uint64_t     hits,      /* conversions saved */
+               misses,    /* conversions done */
+               grows;     /* conversions retried with a larger buffer */
+  uint32_t     ratio8;    /* out len / msg len, in eighths, learned */
+
+  static const uint32_t START_RATIO8 = 24, /* 3x until learned */
+                        MAX_RATIO8   = 128; /* 16x, the old fixed size */
+  NatsXfCache() {
+    ::memset( (void *) this, 0, sizeof( *this ) );
+    this->ratio8 = START_RATIO8;
+  }
+  /* json quotes the names and prints numbers in decimal, rv and tibmsg
+   * differ by headers and type widths, the ratio moves with the field mix
+   * of the msgs converted by this listener */
+  size_t estimate( size_t len ) const {
+    return ( len * this->ratio8 ) / 8 + 256;
+  }
+  void learn( size_t len,  size_t json_len ) {
+    uint32_t r = (uint32_t) ( ( json_len * 8 ) / ( len | 1 ) ) + 2;
+    if ( r > MAX_RATIO8 )
+      r = MAX_RATIO8;
+    if ( r >= this->ratio8 )   /* grow now, shrink slowly */
+      this->ratio8 = r;
+    else
+      this->ratio8 -= ( this->ratio8 - r + 15 ) / 16;
+  }
+  /* convert m to json in spc, sized by estimate(), doubled on overflow up
+   * to the MAX_RATIO8 limit, out is in spc */
+  bool convert( md::MDMsg &m,  md::MDMsgMem &spc,  size_t len,  uint8_t fmt,
+                char *&out,  size_t &out_len ) noexcept;
+  bool equals( const void *m,  uint32_t len,  uint32_t enc ) const {
+    return this->src != NULL && this->msg_len == len &&
+           this->msg_enc == enc && ::memcmp( this->src, m, len ) == 0;
+  }
+  /* size buf for len and src for src_len, false if no memory */
+  bool make( size_t len,  size_t src_len ) noexcept;
+  void release( void ) {
+    if ( this->buf != NULL )
+      ::free( this->buf );
+    if ( this->src != NULL )
+      ::free( this->src );
+    ::memset( (void *) this, 0, sizeof( *this ) );
+    this->ratio8 = START_RATIO8;
+  }
+};
+
 struct EvNatsListen : public kv::EvTcpListen {
   void * operator new( size_t, void *ptr ) { return ptr; }
   kv::RoutePublish & sub_route;
@@ -61,9 +176,28 @@ struct EvNatsListen : public kv::EvTcpListen {
   char               prefix[ MAX_PREFIX_LEN ];
   size_t             prefix_len;
   uint16_t           svc;
+  NatsListenStats    stats;
+  uint64_t           lat_window_ns; /* NATSMD_LATENCY, zero is disabled */
+  bool               stamp_hdr;     /* NATSMD_STAMP_HDR, add time headers */
+  NatsHotTrack     * hot_pub,       /* top subjects published */
+                   * hot_deliver;   /* top subjects delivered, the fan out */
+  uint64_t           max_pending;   /* NATSMD_MAX_PENDING, zero no limit */
+  uint8_t            slow_policy;   /* NATSMD_SLOW_POLICY, NatsSlowPolicy */
+  kv::EvTcpListen  * metrics;       /* NATSMD_METRICS_PORT, http /metrics */
+  uint64_t           zero_copy_min; /* NATSMD_ZEROCOPY_MIN, by reference */
+  uint64_t           flush_bytes;   /* NATSMD_FLUSH_BYTES, write when pending */
+  uint32_t           flush_usecs;   /* NATSMD_FLUSH_USECS, or after usecs */
+  bool               flush_cork;    /* NATSMD_FLUSH_CORK, TCP_CORK a burst */
+  uint32_t           delta_refresh; /* NATSMD_DELTA_REFRESH, full every N */
+  uint64_t           delta_bytes;   /* NATSMD_DELTA_BYTES, images of a conn */
+  const char       * sys_user,      /* NATSMD_SYS_USER, $SYS.REQ admin */
+                   * sys_pass,      /* NATSMD_SYS_PASS, and its password */
+                   * trace_dir;     /* NATSMD_TRACE_DIR, TRACE dumps here */
+  NatsXfCache        xf_cache[ NATS_ENC_CONVERT ]; /* by NatsEncoding */
 
   EvNatsListen( kv::EvPoll &p,  kv::RoutePublish &sr ) noexcept;
   EvNatsListen( kv::EvPoll &p ) noexcept;
+  void init_config( void ) noexcept;
 
   virtual kv::EvSocket *accept( void ) noexcept;
   virtual int listen( const char *ip,  int port,  int opts ) noexcept;
@@ -73,22 +207,36 @@ struct EvNatsListen : public kv::EvTcpListen {
 };
 
 struct EvPrefetchQueue;
+struct NatsSysBuf;
+struct NatsLatency;
+
+/* payloads at least this size are shared by the sids of a connection that
+ * match the same msg, smaller ones are copied with each MSG header */
+static const uint32_t NATS_SHARE_MIN_SIZE = 256;
 
 struct NatsMsgTransform {
   md::MDMsgMem spc;
+  kv::EvPublish & pub;
   const void * msg,
              * hdr;
+  const char * shared;      /* <msg>\r\n queued by the first sid delivered */
   uint32_t     msg_len,
                hdr_len,
                msg_enc,
                idx_ref;
   NatsStr    & sid;
-  bool         is_ready,
+  uint64_t     seq;         /* msg_cnt of the subject or pattern matched */
+  uint8_t      loss;        /* pub_status, if it is a loss status */
+  bool         exact,       /* sid is from an exact subject, not a pattern */
+               is_ready,
+               is_checked,  /* check_transform() done */
                is_converted;
 
   NatsMsgTransform( kv::EvPublish &pub,  NatsStr &id )
-    : msg( pub.msg ), hdr( 0 ), msg_len( pub.msg_len ), hdr_len( pub.hdr_len ),
-      msg_enc( pub.msg_enc ), idx_ref( 0 ), sid( id ), is_ready( false ),
+    : pub( pub ), msg( pub.msg ), hdr( 0 ), shared( 0 ),
+      msg_len( pub.msg_len ), hdr_len( pub.hdr_len ),
+      msg_enc( pub.msg_enc ), idx_ref( 0 ), sid( id ), seq( 0 ), loss( 0 ),
+      exact( false ), is_ready( false ), is_checked( false ),
       is_converted( false ) {
     if ( pub.hdr_len > 0 ) {
       this->hdr = this->msg;
@@ -97,12 +245,16 @@ struct NatsMsgTransform {
     }
   }
 
-  void check_transform( bool bin ) {
-    if ( bin || this->msg_len == 0 || this->msg_enc == MD_STRING )
+  void check_transform( uint8_t enc,  NatsXfCache *cache ) {
+    if ( enc >= NATS_ENC_CONVERT || this->msg_len == 0 ||
+         this->msg_enc == MD_STRING )
       return;
-    this->transform();
+    this->transform( cache[ enc ], enc );
   }
-  void transform( void ) noexcept;
+  void transform( NatsXfCache &cache,  uint8_t fmt ) noexcept;
+  /* add Nats-Deliver-Ns to the header, or strip a header with only
+   * Nats-Recv-Ns when client does not use headers */
+  void stamp_deliver( bool headers ) noexcept;
 };
 
 enum {
@@ -131,7 +283,8 @@ struct NatsMsg {
              subject_len,   /* size of subject */
              reply_len,     /* size of reply */
              sid_len,       /* size of sid */
-             queue_len;     /* size of queue */
+             queue_len,     /* size of queue */
+             fields_len;    /* size of fields */
   size_t     size;          /* size of message */
   uint64_t   msg_len,       /* size of msg_ptr for publish */
              hdr_len,       /* size of hdrs */
@@ -140,8 +293,9 @@ struct NatsMsg {
            * msg_ptr,       /* PUB <subject> [reply] <size>\r\n<msg> */
            * subject,       /* either pub or sub subject */
            * reply,         /* pub reply */
-           * sid,           /* SUB <subject> [queue] <sid> */
-           * queue;         /* queue of sub */
+           * sid,           /* SUB <subject> [queue] <sid> [{fields}] */
+           * queue,         /* queue of sub */
+           * fields;        /* field list of sub, {F1,F2} */
 
   NatsMsg() {
     ::memset( (void *) this, 0, sizeof( *this ) );
@@ -149,12 +303,52 @@ struct NatsMsg {
   int parse_msg( char *start,  char *end ) noexcept;
 };
 
+/* the latest msg frame of a subject and sid, kept while a client with
+ * conflate:true is backpressured, instead of queueing every update */
+struct NatsConflate {
+  char   * frame;      /* MSG <subject> <sid> ... \r\n<msg>\r\n */
+  size_t   frame_len,  /* size of frame */
+           frame_size; /* size allocated */
+  uint32_t hash;       /* hash of value */
+  uint16_t len;        /* len of value */
+  char     value[ 2 ]; /* <subject> <sid> */
+};
+typedef kv::RouteVec<NatsConflate> NatsConflateTab;
+
+/* the "HMSG <subject> <sid> " start of a frame, rendered once for a sid of
+ * an exact subject, MSG frames use &hdr[ 1 ]; keyed by the address of the
+ * sid in the route, which is stable until the map changes map_gen */
+struct NatsMsgHdr {
+  static const size_t HDR_LEN = 110;
+  const char * sid;  /* sid in NatsSubRoute */
+  uint64_t     gen;  /* map_gen when rendered */
+  uint16_t     len;  /* len of hdr[] */
+  char         hdr[ HDR_LEN ];
+};
+
+struct NatsMsgHdrCache {
+  static const uint32_t SIZE = 64; /* power of 2 */
+  NatsMsgHdr e[ SIZE ];
+
+  static NatsMsgHdrCache *create( void ) noexcept;
+  NatsMsgHdr &get( const char *sid ) {
+    uintptr_t x = (uintptr_t) sid;
+    return this->e[ ( ( x >> 8 ) ^ x ) & ( SIZE - 1 ) ];
+  }
+};
+
 enum NatsState { /* msg_state */
-  NATS_HAS_TIMER    = 1, /* timer running */
-  NATS_BACKPRESSURE = 2, /* backpressure */
-  NATS_BUFFERSIZE   = 4  /* input size over recv highwater */
+  NATS_HAS_TIMER     = 1, /* timer running */
+  NATS_BACKPRESSURE  = 2, /* backpressure */
+  NATS_BUFFERSIZE    = 4, /* input size over recv highwater */
+  NATS_SLOW_CONSUMER = 8, /* closing, pending over max_pending */
+  NATS_FLUSH_TIMER   = 16, /* flush timer running */
+  NATS_CORKED        = 32  /* TCP_CORK is set */
 };
 
+/* timer event id of the flush timer, the other timer uses zero */
+static const uint64_t NATS_FLUSH_EID = 1;
+
 struct EvNatsService : public kv::EvConnection, public kv::BPData {
   void * operator new( size_t, void *ptr ) { return ptr; }
   kv::RoutePublish & sub_route;
@@ -168,10 +362,40 @@ struct EvNatsService : public kv::EvConnection, public kv::BPData {
   char       prefix[ MAX_PREFIX_LEN ],
              session[ MAX_SESSION_LEN ];
   uint64_t   timer_id;
+  NatsLatency * lat;       /* latency histograms, if enabled */
+  uint64_t   max_pending,  /* slow consumer limit, from listener */
+             slow_drops;   /* msgs dropped by NATS_SLOW_DROP */
+  uint8_t    slow_policy;  /* NatsSlowPolicy */
+  uint32_t   flush_usecs;  /* max delay of a msg when coalescing writes */
+  bool       flush_cork;   /* cork socket while coalescing */
+  NatsConflateTab * conflate_tab; /* latest msgs when conflating */
+  uint64_t   conflate_cnt, /* frames in conflate_tab */
+             conflated,    /* msgs replaced by a later msg */
+             backpressure_cnt, /* pubs which backpressured this publisher */
+             convert_cnt,  /* msgs transformed to json */
+             zero_ref_cnt, /* msgs appended by reference */
+             zero_ref_bytes, /* bytes not copied by those */
+             zero_copy_min, /* referenced if this size, zero is highwater */
+             flush_bytes,  /* write when pending is over, from listener */
+             flush_timer_cnt, /* writes started by the flush timer */
+             map_gen,      /* changed when a sid is added or removed */
+             read_calls,   /* EvConnection::read() calls */
+             write_calls;  /* EvConnection::write() calls */
+  NatsMsgHdrCache * hdr_cache; /* MSG headers of exact subject sids */
+  NatsProjTab * proj_tab;  /* sids with a field list */
+  uint64_t   proj_cnt;     /* msgs sent with only the fields listed */
+  NatsImageTab * image_tab; /* last fields sent, when user.delta */
+  uint64_t   delta_cnt,    /* msgs sent as the fields changed */
+             delta_saved,  /* json bytes not sent by those */
+             image_bytes,  /* size of the images and their keys */
+             image_clock,  /* stamps NatsFieldImage::used */
+             delta_evicts; /* images dropped to stay under delta_bytes */
 
   EvNatsService( kv::EvPoll &p,  const uint8_t t,  EvNatsListen &l,
                  kv::EvConnectionNotify *n )
-    : kv::EvConnection( p, t, n ), sub_route( l.sub_route ), listen( l ) {}
+    : kv::EvConnection( p, t, n ), sub_route( l.sub_route ), listen( l ),
+      lat( 0 ), conflate_tab( 0 ), hdr_cache( 0 ), proj_tab( 0 ),
+      image_tab( 0 ) {}
 
   void initialize_state( const char *pre,  size_t prelen,  uint64_t id ) {
     this->nats_state  = 0;
@@ -181,21 +405,89 @@ struct EvNatsService : public kv::EvConnection, public kv::BPData {
     this->session_len = 0;
     this->timer_id    = id;
     this->bp_flags    = kv::BP_NOTIFY;
+    this->max_pending = 0;
+    this->slow_drops  = 0;
+    this->slow_policy = NATS_SLOW_STALL;
+    this->conflate_cnt = 0;
+    this->conflated   = 0;
+    this->backpressure_cnt = 0;
+    this->convert_cnt  = 0;
+    this->zero_ref_cnt = 0;
+    this->zero_ref_bytes = 0;
+    this->zero_copy_min = 0;
+    this->flush_bytes  = 0;
+    this->flush_timer_cnt = 0;
+    this->flush_usecs  = 0;
+    this->flush_cork   = false;
+    this->map_gen      = 1;
+    this->read_calls   = 0;
+    this->write_calls  = 0;
+    this->proj_cnt     = 0;
+    this->delta_cnt    = 0;
+    this->delta_saved  = 0;
+    this->image_bytes  = 0;
+    this->image_clock  = 0;
+    this->delta_evicts = 0;
   }
   void add_sub( NatsMsg &msg ) noexcept;
   void rem_sid( NatsMsg &msg ) noexcept;
   void rem_all_sub( void ) noexcept;
   enum { NATS_FLOW_GOOD = 0, NATS_FLOW_BACKPRESSURE = 1, NATS_FLOW_STALLED = 2 };
   int fwd_pub( NatsMsg &msg ) noexcept;
+  void stamp_recv( NatsMsg &msg ) noexcept;
   bool fwd_msg( kv::EvPublish &pub,  NatsMsgTransform &xf ) noexcept;
+  /* convert once for the sids which send the msg as published */
+  void transform_msg( NatsMsgTransform &xf ) {
+    if ( ! xf.is_checked ) {
+      xf.is_checked = true;
+      xf.check_transform( this->user.encoding, this->listen.xf_cache );
+      if ( xf.is_converted )
+        this->convert_cnt++;
+    }
+  }
+  /* schedule a write of msgs appended, now or when flush policy is met */
+  bool flush_msgs( void ) noexcept;
+  void set_cork( bool on ) noexcept;
+  const char *msg_hdr( const char *sub,  size_t sublen,  const char *sid,
+                       size_t sid_len,  size_t &len ) noexcept;
+  void slow_consumer( void ) noexcept;
+  char *conflate_frame( const char *sub,  size_t sublen,  const char *sid,
+                        size_t sid_len,  size_t len ) noexcept;
+  void conflate_flush( void ) noexcept;
+  void conflate_release( void ) noexcept;
+  /* the field list of a sid, set by SUB, removed by UNSUB */
+  void proj_set( NatsStr &sid,  const char *fields,  size_t len ) noexcept;
+  void proj_remove( NatsStr &sid ) noexcept;
+  void proj_release( void ) noexcept;
+  /* the image of <subject> <sid>, created empty, dropped when the sid is */
+  NatsFieldImage *delta_image( const char *sub,  size_t sublen,
+                               const char *sid,  size_t sid_len ) noexcept;
+  void delta_purge( NatsStr &sid ) noexcept;
+  /* drop the least recently used images when over listen.delta_bytes */
+  void delta_evict( void ) noexcept;
+  void delta_release( void ) noexcept;
   void parse_connect( const char *buf,  size_t sz ) noexcept;
   bool on_inbox_reply( kv::EvPublish &pub ) noexcept;
+  /* whether CONNECT has the user and pass of NATSMD_SYS_USER, _PASS */
+  bool sys_allowed( void ) const noexcept;
+  /* handle PUB $SYS.REQ.<kind> <reply> locally, return false if unknown */
+  bool sys_request( NatsMsg &msg,  const char *rep,  size_t replen ) noexcept;
+  void sys_reply( const char *rep,  size_t replen,  const void *data,
+                  size_t datalen ) noexcept;
+  void sys_subsz( NatsSysBuf &out,  NatsMsg &msg ) noexcept;
+  void sys_varz( NatsSysBuf &out ) noexcept;
+  void sys_connz( NatsSysBuf &out,  NatsMsg &msg ) noexcept;
+  void sys_latz( NatsSysBuf &out,  NatsMsg &msg ) noexcept;
+  void sys_hotz( NatsSysBuf &out,  NatsMsg &msg ) noexcept;
+  void sys_trace( NatsSysBuf &out,  NatsMsg &msg ) noexcept;
+  void sys_metrics( NatsSysBuf &out ) noexcept;
   /* EvSocket */
   virtual void process( void ) noexcept;
   virtual void process_close( void ) noexcept;
   virtual void release( void ) noexcept;
   virtual bool timer_expire( uint64_t tid, uint64_t eid ) noexcept;
   virtual void read( void ) noexcept;
+  virtual void write( void ) noexcept;
   virtual bool hash_to_sub( uint32_t h, char *k, size_t &klen ) noexcept;
   virtual bool on_msg( kv::EvPublish &pub ) noexcept;
   virtual uint8_t is_subscribed( const kv::NotifySub &sub ) noexcept;
@@ -256,6 +548,10 @@ struct EvNatsService : public kv::EvConnection, public kv::BPData {
 #define NATS_JS_HEADERS      NATS_KW( 'H', 'E', 'A', 'D' )
 #define NATS_JS_NO_RESPOND   NATS_KW( 'N', 'O', '_', 'R' )
 #define NATS_JS_BINARY       NATS_KW( 'B', 'I', 'N', 'A' )
+#define NATS_JS_ENCODING     NATS_KW( 'E', 'N', 'C', 'O' )
+#define NATS_JS_DELTA        NATS_KW( 'D', 'E', 'L', 'T' )
+#define NATS_JS_CONFLATE     NATS_KW( 'C', 'O', 'N', 'F' )
+#define NATS_JS_SEQUENCE     NATS_KW( 'S', 'E', 'Q', 'U' )
 #define NATS_JS_SERVER       NATS_KW( 'S', 'E', 'R', 'V' )
 #define NATS_JS_MAX_PAYLOAD  NATS_KW( 'M', 'A', 'X', '_' )
 #define NATS_JS_CONNECT_URLS NATS_KW( 'C', 'O', 'N', 'N' )
@@ -330,6 +626,35 @@ struct NatsArgs {
   }
 };
 
+/* latency stamp headers, when listener stamp_hdr is enabled:
+ *   Nats-Recv-Ns: <realtime ns when PUB was parsed>
+ *   Nats-Deliver-Ns: <realtime ns when MSG was queued to subscriber> */
+static const char NATS_HDR_STATUS[]     = "NATS/1.0\r\n",
+                  NATS_HDR_RECV_NS[]    = "Nats-Recv-Ns: ",
+                  NATS_HDR_DELIVER_NS[] = "Nats-Deliver-Ns: ",
+/* sequence headers, when client connects with headers:true, sequence:true:
+ *   Nats-Seq: <msg count of the subscription that matched>
+ *   Nats-Loss: <pub_status>, when the bus reports msgs were lost */
+                  NATS_HDR_SEQ[]        = "Nats-Seq: ",
+                  NATS_HDR_LOSS[]       = "Nats-Loss: ",
+/* fragment headers, when a nats client streams fragments:
+ *   Nats-Frag-Offset: <offset of the fragment in the msg>
+ *   Nats-Frag-Size: <size of the whole msg> */
+                  NATS_HDR_FRAG_OFF[]   = "Nats-Frag-Offset: ",
+                  NATS_HDR_FRAG_SIZE[]  = "Nats-Frag-Size: ";
+static const size_t NATS_HDR_STATUS_LEN = sizeof( NATS_HDR_STATUS ) - 1;
+/* space needed to add a stamp to a header */
+static inline size_t nats_hdr_stamp_size( size_t name_len ) {
+  return NATS_HDR_STATUS_LEN + name_len + 20 + 4;
+}
+/* insert "<name><ns>\r\n" after the status line of hdr, or create a header
+ * with only the stamp if hdr_len is zero, return the length of out */
+size_t nats_hdr_stamp( char *out,  const char *hdr,  size_t hdr_len,
+                       const char *name,  size_t name_len,
+                       uint64_t ns ) noexcept;
+/* if hdr was created by nats_hdr_stamp() with Nats-Recv-Ns */
+bool nats_hdr_is_recv_only( const char *hdr,  size_t hdr_len ) noexcept;
+
 #define is_nats_debug kv_unlikely( nats_debug != 0 )
 extern uint32_t nats_debug;
 
@@ -42,19 +42,47 @@ struct NatsFragment {
                * back;
   uint64_t       src_id,   /* the source that created the frags */
                  src_time; /* the time that the message was published */
+  uint64_t       start_ns; /* when the first fragment was recvd */
   uint32_t       hash,     /* hash of the subject envelope */
                  off,      /* offset of the fragments recvd */
                  msg_len,  /* total length of fragment */
-                 pad;      /* alignment */
+                 buf_size; /* size of data, zero when streamed */
   /* data follows */
-  NatsFragment( uint64_t src,  uint64_t t,  uint32_t h, uint32_t len )
-    : next( 0 ), back( 0 ), src_id( src ), src_time( t ), hash( h ),
-      off( 0 ), msg_len( len ), pad( 0 ) {}
+  NatsFragment( uint64_t src,  uint64_t t,  uint32_t h, uint32_t len,
+                uint64_t ns,  uint32_t sz )
+    : next( 0 ), back( 0 ), src_id( src ), src_time( t ), start_ns( ns ),
+      hash( h ), off( 0 ), msg_len( len ), buf_size( sz ) {}
   void *msg_ptr( void ) {
     return &this[ 1 ];
   }
 };
 
+/* the fields of a trailer which identify the message of a fragment */
+struct FragKey {
+  uint64_t src_id,
+           src_time;
+  uint32_t hash,
+           msg_len;
+  FragKey() {}
+  FragKey( const NatsTrailer &t )
+    : src_id( t.src_id ), src_time( t.src_time ), hash( t.hash ),
+      msg_len( t.msg_len ) {}
+  FragKey( const NatsFragment &f )
+    : src_id( f.src_id ), src_time( f.src_time ), hash( f.hash ),
+      msg_len( f.msg_len ) {}
+  bool operator==( const FragKey &k ) const {
+    return this->src_id == k.src_id && this->src_time == k.src_time &&
+           this->hash == k.hash && this->msg_len == k.msg_len;
+  }
+  size_t operator&( size_t mod ) const {
+    uint64_t h = this->src_id ^ ( this->src_time * 0x9e3779b97f4a7c15ULL ) ^
+                 ( (uint64_t) this->hash << 32 );
+    return (size_t) ( h ^ ( h >> 29 ) ) & mod;
+  }
+};
+
+typedef kv::IntHashTabT<FragKey,NatsFragment *> FragHashTab;
+
 /* wildcards subscribed by prefix */
 struct NatsPrefix {
   uint32_t hash;        /* hash of wildcard prefix */
@@ -63,6 +91,43 @@ struct NatsPrefix {
   char     value[ 2 ];  /* the prefix */
 };
 
+/* the wildcard prefixes in a trie, a walk over a subject finds the max sid
+ * of the prefixes which match it; node[ 0 ] is the empty prefix, children
+ * are in a sibling list */
+struct NatsPrefixTrie {
+  struct Node {
+    uint32_t child,   /* first child, 0 if none */
+             sibling, /* next child of the parent, or next free node */
+             sid,     /* sid of the prefix which ends here, 0 if none */
+             cnt;     /* count of prefixes through this node */
+    char     c;       /* char of the prefix at this depth */
+  };
+  Node   * node;
+  uint32_t node_cnt,  /* nodes used, including the free list */
+           node_size, /* nodes allocated */
+           free_list; /* unlinked nodes, 0 if none */
+
+  NatsPrefixTrie() : node( 0 ), node_cnt( 0 ), node_size( 0 ),
+                     free_list( 0 ) {}
+  /* add prefix with sid, false if no memory */
+  bool add( const char *pre,  size_t len,  uint32_t sid ) noexcept;
+  /* remove prefix, the nodes not used are freed */
+  void remove( const char *pre,  size_t len ) noexcept;
+  /* max sid of the prefixes of sub, 0 if no prefix matches */
+  uint32_t max_sid( const char *sub,  size_t len ) const noexcept;
+  void release( void ) noexcept;
+  uint32_t find_child( uint32_t n,  char c ) const {
+    for ( uint32_t i = this->node[ n ].child; i != 0;
+          i = this->node[ i ].sibling )
+      if ( this->node[ i ].c == c )
+        return i;
+    return 0;
+  }
+  /* make room for cnt nodes, so that new_node() does not fail */
+  bool reserve( uint32_t cnt ) noexcept;
+  uint32_t new_node( char c ) noexcept;
+};
+
 struct SidHash {
   uint32_t hash[ 4 ];
   SidHash() {}
@@ -138,9 +203,21 @@ struct EvNatsClient : public kv::EvConnection, public kv::RouteNotify {
   uint32_t       wild_prefix_char[ 3 ]; /* first char of wildcard [ '!' -> 127 ]*/
   size_t         max_payload;  /* 1024 * 1024 */
 
-  kv::DLinkList<NatsFragment> frags_pending;  /* large message fragments */
+  kv::DLinkList<NatsFragment> frags_pending;  /* large message fragments,
+                                                 oldest at hd */
+  FragHashTab               * frag_ht;        /* trailer -> frags_pending */
+  uint64_t                    frag_mem,       /* bytes of frags_pending */
+                              frag_timer_id,  /* ignore timers of old conns */
+                              frag_completed, /* msgs reassembled */
+                              frag_timeouts,  /* incomplete after timeout */
+                              frag_evicted,   /* dropped for the mem limit */
+                              frag_dropped,   /* missing or out of order */
+                              frag_zero_ref;  /* frags sent by reference */
+  bool                        frag_timer_on,  /* timeout timer running */
+                              frag_stream;    /* fwd each frag as recvd */
   SidHashTab                * sid_ht;         /* sub to sid */
   kv::RouteVec<NatsPrefix>    pat_tab;        /* wildcard patterns */
+  NatsPrefixTrie              pat_trie;       /* pat_tab prefixes by char */
 
   uint32_t        wild_prefix_char_cnt[ 96 ];  /* count of all wildcard[ 0 ] */
   char            prefix[ MAX_PREFIX_LEN ],
@@ -205,9 +282,18 @@ struct EvNatsClient : public kv::EvConnection, public kv::RouteNotify {
   void parse_info( const char *info,  size_t infolen ) noexcept;
   /* when no subscribers left, NATS connection can be shutdown */
   void do_shutdown( void ) noexcept;
+  /* find the msg of a fragment, or start one with data_size bytes */
+  NatsFragment *find_fragment( NatsTrailer &trail,
+                               size_t data_size ) noexcept;
   /* merge a NATS MSG into a larger than max_payload message*/
   NatsFragment *merge_fragment( NatsTrailer &trail,  const void *msg,
                                 size_t msg_len ) noexcept;
+  /* track the offset of a streamed fragment, false if out of order */
+  bool stream_fragment( NatsTrailer &trail,  size_t msg_len ) noexcept;
+  /* remove frag from frags_pending and frag_ht */
+  void pop_fragment( NatsFragment *p ) noexcept;
+  /* drop frags older than the timeout, true if some are still pending */
+  bool expire_fragments( uint64_t now ) noexcept;
   /* release all frags on shutdown */
   void release_fragments( void ) noexcept;
   /* save error strings that occur while processing */
@@ -218,6 +304,7 @@ struct EvNatsClient : public kv::EvConnection, public kv::RouteNotify {
   virtual void process( void ) noexcept; /* decode read buffer */
   virtual void process_close( void ) noexcept;
   virtual void release( void ) noexcept; /* after shutdown release mem */
+  virtual bool timer_expire( uint64_t tid, uint64_t eid ) noexcept;
   virtual bool on_msg( kv::EvPublish &pub ) noexcept; /* fwd to NATS network */
   bool publish( kv::EvPublish &pub ) noexcept;
   bool publish2( kv::EvPublish &pub,  const char *sub,  size_t sublen,
@@ -0,0 +1,90 @@
+#ifndef __rai_natsmd__nats_hot_h__
+#define __rai_natsmd__nats_hot_h__
+
+#include <stdint.h>
+#include <string.h>
+
+namespace rai {
+namespace natsmd {
+
+/* a subject in the top N heap, the subject is truncated to SUBJ_LEN */
+struct NatsHotEntry {
+  static const size_t SUBJ_LEN = 94;
+  uint64_t count;              /* estimate from sketch */
+  uint32_t hash;               /* subject hash */
+  uint16_t len;                /* len of subj[], may be truncated */
+  char     subj[ SUBJ_LEN ];
+};
+
+/* min heap of the top N counts, root is the smallest, replaced when a
+ * subject estimate is larger */
+struct NatsHotHeap {
+  static const uint32_t TOP_N = 32;
+  NatsHotEntry e[ TOP_N ];
+  uint32_t     n;
+
+  uint64_t min_count( void ) const {
+    return this->n < TOP_N ? 0 : this->e[ 0 ].count;
+  }
+  void update( uint32_t h,  const char *sub,  size_t len,
+               uint64_t est ) noexcept;
+  void sift_down( uint32_t i ) noexcept;
+  void sift_up( uint32_t i ) noexcept;
+  /* copy entries to out[], sorted largest first, return count */
+  uint32_t sorted( NatsHotEntry *out ) const noexcept;
+};
+
+/* count-min sketch of msgs and bytes by subject, with the top N of each;
+ * add() is DEPTH counter increments and a compare with the heap min, the
+ * heap is only searched when a subject is at or above the min; with a
+ * sample of N, one msg in N is added with a weight of N */
+struct NatsHotTrack {
+  static const uint32_t DEPTH      = 4,
+                        WIDTH_BITS = 11,
+                        WIDTH      = 1U << WIDTH_BITS;
+  uint64_t    msgs[ DEPTH ][ WIDTH ],
+              bytes[ DEPTH ][ WIDTH ],
+              total_msgs,
+              total_bytes,
+              start_ns;
+  NatsHotHeap top_msgs,
+              top_bytes;
+  uint32_t    sample,          /* add one msg in sample */
+              skip;            /* msgs until the next is added */
+
+  static NatsHotTrack *create( uint32_t sample ) noexcept;
+  void zero( void ) noexcept;
+
+  static uint32_t row( uint32_t h,  uint32_t i ) {
+    static const uint32_t mix[ DEPTH ] =
+      { 0x9e3779b1U, 0x85ebca77U, 0xc2b2ae3dU, 0x27d4eb2fU };
+    return ( ( h ^ ( h >> 16 ) ) * mix[ i ] ) >> ( 32 - WIDTH_BITS );
+  }
+  void add( uint32_t h,  const char *sub,  size_t len,  size_t sz ) {
+    if ( this->skip > 1 ) {
+      this->skip--;
+      return;
+    }
+    this->skip = this->sample;
+    uint64_t m = (uint64_t) -1, b = (uint64_t) -1,
+             w = this->sample,
+             wsz = (uint64_t) sz * w;
+    for ( uint32_t i = 0; i < DEPTH; i++ ) {
+      uint32_t j = row( h, i );
+      uint64_t x = ( this->msgs[ i ][ j ] += w ),
+               y = ( this->bytes[ i ][ j ] += wsz );
+      if ( x < m ) m = x;
+      if ( y < b ) b = y;
+    }
+    this->total_msgs  += w;
+    this->total_bytes += wsz;
+    if ( m >= this->top_msgs.min_count() )
+      this->top_msgs.update( h, sub, len, m );
+    if ( b >= this->top_bytes.min_count() )
+      this->top_bytes.update( h, sub, len, b );
+  }
+};
+
+}
+}
+#endif
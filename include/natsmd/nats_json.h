@@ -0,0 +1,70 @@
+#ifndef __rai_natsmd__nats_json_h__
+#define __rai_natsmd__nats_json_h__
+
+#include <stdint.h>
+#include <string.h>
+#include <raimd/md_msg.h>
+
+namespace rai {
+namespace natsmd {
+
+/* the json writer of the transform, strings, ints, reals, decimals and
+ * booleans are written here, the escape scan is 16 bytes at a time with
+ * SSE2 and ints are formatted two digits at a time; the other types
+ * (messages, arrays, dates, decimal nan and fractions) are appended by a
+ * JsonMsgWriter in place */
+struct NatsJsonWriter {
+  md::MDMsgMem & mem;
+  char         * buf;
+  size_t         off,
+                 buflen;
+  int            err;    /* nonzero when out of space or a field failed */
+  uint32_t       fcnt;   /* fields appended, a comma before the next */
+
+  NatsJsonWriter( md::MDMsgMem &m,  void *b,  size_t len )
+    : mem( m ), buf( (char *) b ), off( 0 ), buflen( len ), err( 0 ),
+      fcnt( 0 ) {
+    if ( len > 0 )
+      this->buf[ this->off++ ] = '{';
+    else
+      this->err = -1;
+  }
+  bool has_space( size_t len ) {
+    if ( this->off + len <= this->buflen )
+      return true;
+    this->err = -1;
+    return false;
+  }
+  /* "fname":value, a trailing nul of fname is not written */
+  int append_ref( const char *fname,  size_t fname_len,
+                  md::MDReference &mref ) noexcept;
+  /* append all the fields of m */
+  int convert_msg( md::MDMsg &m ) noexcept;
+  bool finish( void ) {
+    if ( this->err != 0 || ! this->has_space( 2 ) )
+      return false;
+    this->buf[ this->off++ ] = '}';
+    this->buf[ this->off ] = '\0';
+    return true;
+  }
+  void string( const char *s,  size_t len ) noexcept;
+  void int64( int64_t v ) noexcept;
+  void uint64( uint64_t v ) noexcept;
+  void real( double v ) noexcept;
+  /* u / 10^k with k decimals, k <= 19 */
+  void fixed( uint64_t u,  uint32_t k,  bool neg ) noexcept;
+  /* a decimal with a power of 10 hint, false if it needs other() */
+  bool decimal( md::MDReference &mref ) noexcept;
+  bool other( const char *fname,  size_t fname_len,
+              md::MDReference &mref ) noexcept;
+};
+
+/* offset of the first byte of s which must be escaped in a json string,
+ * a quote, a backslash or a control char, len if none */
+size_t nats_json_escape_scan( const char *s,  size_t len ) noexcept;
+/* decimal digits of v into out, return len, out has room for 20 */
+size_t nats_json_uint_str( uint64_t v,  char *out ) noexcept;
+
+}
+}
+#endif
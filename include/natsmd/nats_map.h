@@ -333,6 +333,61 @@ struct NatsPatternTab : public kv::RouteVec<NatsPatternRoute> {
   }
 };
 
+/* cardinality of one of the NatsSubMap tables */
+struct NatsTabStats {
+  static const size_t HIST_SIZE = 8; /* 1, 2, 3-4, 5-8, ..., 65+ */
+  uint32_t count,                   /* number of entries */
+           collisions,              /* entries which share a hash */
+           max_chain,               /* most entries with the same hash */
+           chain_hist[ HIST_SIZE ]; /* histogram of chain lengths */
+  uint64_t bytes;                   /* bytes used by the entries */
+
+  void zero( void ) {
+    ::memset( (void *) this, 0, sizeof( *this ) );
+  }
+  static uint32_t hist_bucket( uint32_t n ) {
+    uint32_t b = 0;
+    for ( n = ( n > 0 ? n - 1 : 0 ); n != 0; n >>= 1 )
+      b++;
+    return b < HIST_SIZE ? b : HIST_SIZE - 1;
+  }
+  void add_chain( uint32_t n ) {
+    this->chain_hist[ hist_bucket( n ) ]++;
+    if ( n > this->max_chain )
+      this->max_chain = n;
+    if ( n > 1 )
+      this->collisions += n;
+  }
+};
+
+/* stats of the subject, pattern and sid tables, NatsSubMap::stats() */
+struct NatsMapStats {
+  static const size_t HIST_SIZE = NatsTabStats::HIST_SIZE;
+  NatsTabStats sub,                        /* sub_tab */
+               qsub,                       /* qsub_tab */
+               pat,                        /* pat_tab */
+               qpat,                       /* qpat_tab */
+               sid;                        /* sid_tab */
+  uint32_t     wild_count,                 /* number of patterns */
+               max_per_prefix,             /* most patterns on a prefix */
+               per_prefix_hist[ HIST_SIZE ], /* patterns per prefix */
+               sid_hist[ HIST_SIZE ];      /* sid list len of subjs and pats */
+  const char * max_prefix;                 /* prefix with max_per_prefix */
+  uint16_t     max_prefix_len;
+
+  void zero( void ) {
+    ::memset( (void *) this, 0, sizeof( *this ) );
+  }
+  uint64_t total_bytes( void ) const {
+    return this->sub.bytes + this->qsub.bytes + this->pat.bytes +
+           this->qpat.bytes + this->sid.bytes;
+  }
+  uint32_t total_collisions( void ) const {
+    return this->sub.collisions + this->qsub.collisions +
+           this->pat.collisions + this->qpat.collisions;
+  }
+};
+
 struct NatsSubMap {
   NatsSubTab             sub_tab,
                          qsub_tab;
@@ -341,6 +396,16 @@ struct NatsSubMap {
   kv::RouteVec<SidEntry> sid_tab;
 
   void print( void ) noexcept;
+  /* count entries, collision chains and memory used by each table */
+  void stats( NatsMapStats &st ) noexcept;
+  /* only the entry counts of stats(), without walking the tables */
+  void counts( NatsMapStats &st ) noexcept;
+  /* entries which stats() walks, the tables are not walked */
+  size_t entry_count( void ) {
+    return this->sub_tab.pop_count() + this->qsub_tab.pop_count() +
+           this->pat_tab.pop_count() + this->qpat_tab.pop_count() +
+           this->sid_tab.pop_count();
+  }
   /* add a subject and sid */
   NatsSubStatus put( NatsStr &subj,  NatsStr &sid,  bool &collision,
                      NatsSubRoute *&sub_rt ) {
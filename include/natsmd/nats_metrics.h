@@ -0,0 +1,49 @@
+#ifndef __rai_natsmd__nats_metrics_h__
+#define __rai_natsmd__nats_metrics_h__
+
+#include <raikv/ev_tcp.h>
+
+namespace rai {
+namespace natsmd {
+
+struct EvNatsListen;
+struct NatsSysBuf;
+
+/* format the listener totals in prometheus text exposition format:
+ *
+ *   # HELP natsmd_in_msgs_total Msgs published by clients
+ *   # TYPE natsmd_in_msgs_total counter
+ *   natsmd_in_msgs_total 1234
+ *
+ * the counters are plain uint64_t of each connection, updated only by the
+ * poll thread which owns the connection, so none are locked or atomic */
+void nats_metrics_text( EvNatsListen &l,  NatsSysBuf &out ) noexcept;
+
+/* a http listener for scraping, created by EvNatsListen::listen() when
+ * NATSMD_METRICS_PORT=<port> is set, answers GET /metrics and closes */
+struct EvNatsMetricsListen : public kv::EvTcpListen {
+  void * operator new( size_t, void *ptr ) { return ptr; }
+  EvNatsListen & nats;
+
+  EvNatsMetricsListen( kv::EvPoll &p,  EvNatsListen &l ) noexcept;
+
+  virtual kv::EvSocket *accept( void ) noexcept;
+  virtual int listen( const char *ip,  int port,  int opts ) noexcept;
+};
+
+struct EvNatsMetricsService : public kv::EvConnection {
+  void * operator new( size_t, void *ptr ) { return ptr; }
+  EvNatsMetricsListen & listen;
+
+  EvNatsMetricsService( kv::EvPoll &p,  const uint8_t t,
+                        EvNatsMetricsListen &l )
+    : kv::EvConnection( p, t ), listen( l ) {}
+
+  /* EvSocket */
+  virtual void process( void ) noexcept;
+  virtual void release( void ) noexcept;
+};
+
+}
+}
+#endif
@@ -0,0 +1,68 @@
+#ifndef __rai_natsmd__nats_proj_h__
+#define __rai_natsmd__nats_proj_h__
+
+#include <stdint.h>
+#include <string.h>
+#include <raikv/route_ht.h>
+#include <raimd/md_msg.h>
+
+namespace rai {
+namespace natsmd {
+
+/* the field list of SUB <subject> [queue] <sid> {F1,F2,...}, the names are
+ * stored as <len><name>, without the braces and commas */
+struct NatsFieldList {
+  static const uint32_t MAX_FIELDS = 64;
+  uint16_t cnt,        /* count of names */
+           len;        /* size of names[] */
+  char     names[ 2 ];
+
+  /* parse "{F1,F2}", NULL if empty or too many */
+  static NatsFieldList *create( const char *list,  size_t len ) noexcept;
+  /* fname may include the nul terminator, as rv and tibmsg do */
+  bool match( const char *fname,  size_t fnamelen ) const noexcept;
+};
+
+/* a sid with a field list, in a table of the connection keyed by sid */
+struct NatsProjEntry {
+  NatsFieldList * fields;
+  uint32_t        hash;       /* hash of sid */
+  uint16_t        len;        /* len of sid */
+  char            value[ 2 ]; /* the sid */
+};
+typedef kv::RouteVec<NatsProjEntry> NatsProjTab;
+
+/* the fields last sent to <subject> <sid> of a connection with
+ * "delta":true, so that the next msg is sent as the fields which changed;
+ * buf has entries of <u8 name len><name><u8 type><u32 size><data> */
+struct NatsFieldImage {
+  char          * buf;
+  uint64_t        used;       /* image_clock of the last msg, for eviction */
+  uint32_t        buf_len,
+                  buf_size,
+                  update_cnt, /* msgs since created, full every refresh */
+                  full_len;   /* json size of the last full msg */
+  uint32_t        hash;       /* hash of value */
+  uint16_t        len;        /* len of value */
+  char            value[ 2 ]; /* <subject> <sid> */
+};
+typedef kv::RouteVec<NatsFieldImage> NatsImageTab;
+
+/* decode msg and write json of the fields which differ from img, or if
+ * full the msg merged with img, then merge the msg into img, a partial
+ * update replaces only the fields it has; out is in spc, false if msg does
+ * not decode */
+bool nats_delta( md::MDMsgMem &spc,  const void *msg,  size_t msg_len,
+                 NatsFieldImage &img,  bool full,  char *&out,
+                 size_t &out_len ) noexcept;
+
+/* decode msg and write the fields in fl with the writer of enc, a
+ * NatsEncoding, raw keeps rv and tibmsg and writes json for the others;
+ * out is in spc, false if msg does not decode to fields */
+bool nats_project( md::MDMsgMem &spc,  const void *msg,  size_t msg_len,
+                   uint32_t msg_enc,  uint8_t enc,  const NatsFieldList &fl,
+                   char *&out,  size_t &out_len ) noexcept;
+
+}
+}
+#endif
@@ -0,0 +1,185 @@
+#ifndef __rai_natsmd__nats_sys_h__
+#define __rai_natsmd__nats_sys_h__
+
+#include <raikv/util.h>
+#include <natsmd/nats_map.h>
+
+struct hdr_histogram;
+
+namespace rai {
+namespace natsmd {
+
+struct EvNatsListen;
+
+/* requests handled by the server, not forwarded:
+ *
+ * PUB $SYS.REQ.SERVER.SUBSZ <reply> 26
+ * {"offset":0,"limit":64}
+ * PUB $SYS.REQ.SERVER.VARZ <reply> 0
+ * PUB $SYS.REQ.SERVER.CONNZ <reply> 28
+ * {"offset":0,"limit":1024}
+ * PUB $SYS.REQ.SERVER.LATZ <reply> 0
+ * PUB $SYS.REQ.SERVER.HOTZ <reply> 11
+ * {"reset":1}
+ * PUB $SYS.REQ.SERVER.TRACE <reply> 23
+ * {"enable":0,"dump":1}
+ * PUB $SYS.REQ.SERVER.METRICS <reply> 0
+ *
+ * the last token of the subject selects the report, the prefix may be
+ * anything after $SYS.REQ., for example $SYS.REQ.SERVER.PING.SUBSZ; only
+ * the connection with the CONNECT user of NATSMD_SYS_USER may ask, for
+ * the others the pub is forwarded as any other
+ *
+ * a reply is built in the event loop on the requester's connection, the
+ * work of one request is bounded: VARZ and METRICS sum the counters of
+ * each connection, CONNZ and LATZ format at most NATS_SYS_CONNZ_LIMIT
+ * connections and SUBSZ at most NATS_SYS_SUBSZ_LIMIT, a larger limit is
+ * cut to these, the rest is paged with offset; each scans the fd table
+ * once to find the connections of the listener; SUBSZ also walks at most
+ * NATS_SYS_SUBSZ_VISIT sub map entries, the page ends at the connection
+ * which does not fit and the reply has the "next" offset to ask for */
+static const char   NATS_SYS_REQ[]    = "$SYS.REQ.";
+static const size_t NATS_SYS_REQ_LEN  = sizeof( NATS_SYS_REQ ) - 1;
+
+enum NatsSysKind {
+  NATS_SYS_NONE    = 0,
+  NATS_SYS_SUBSZ   = 1, /* NatsSubMap::stats(), paged by offset/limit */
+  NATS_SYS_VARZ    = 2, /* listener totals */
+  NATS_SYS_CONNZ   = 3, /* counters of each connection, paged by offset/limit */
+  NATS_SYS_LATZ    = 4, /* latency histograms of each connection */
+  NATS_SYS_HOTZ    = 5, /* top subjects by msgs and bytes */
+  NATS_SYS_TRACE   = 6, /* enable, disable and dump trace ring */
+  NATS_SYS_METRICS = 7  /* listener totals in prometheus text format */
+};
+
+/* connz and latz reply with at most this many connections per request */
+static const uint64_t NATS_SYS_CONNZ_LIMIT = 1024;
+/* subsz walks the whole sub map of a connection, fewer per request */
+static const uint64_t NATS_SYS_SUBSZ_LIMIT = 64;
+/* subsz walks at most this many entries of the maps per request, a map
+ * larger than this is not walked, only the entry counts are replied */
+static const uint64_t NATS_SYS_SUBSZ_VISIT = 64 * 1024;
+
+/* return which report the subject requests */
+NatsSysKind nats_sys_kind( const char *sub,  size_t sublen ) noexcept;
+/* the 22 char server id in INFO */
+const char *nats_server_id( void ) noexcept;
+/* find "name":<number> in a request payload, return dflt if not found */
+uint64_t nats_sys_param( const char *msg,  size_t len,  const char *name,
+                         uint64_t dflt ) noexcept;
+
+/* listener totals, the live connections are added to the closed ones */
+struct NatsVarz {
+  uint64_t msgs_recv,
+           msgs_sent,
+           bytes_recv,
+           bytes_sent,
+           pending,      /* bytes queued to write */
+           subs,         /* sids of all connections */
+           slow_drops,
+           backpressure, /* pubs which backpressured */
+           converts,     /* msgs transformed */
+           zero_refs,    /* msgs appended by reference */
+           zero_ref_bytes, /* bytes not copied */
+           flush_timers, /* writes started by the flush timer */
+           read_calls,   /* EvConnection::read() calls */
+           write_calls,  /* EvConnection::write() calls */
+           xf_hits,      /* NatsXfCache of each encoding */
+           xf_misses,
+           xf_grows;
+  uint32_t cnt,          /* live connections */
+           bp_cnt,       /* connections backpressured now */
+           slow_cnt;     /* connections with input over recv highwater */
+
+  void gather( EvNatsListen &l ) noexcept;
+};
+
+/* the latency window from env NATSMD_LATENCY=<secs>, zero if disabled */
+uint64_t nats_latency_window_ns( void ) noexcept;
+
+/* latencies of a path, the current window is moved to prev when it is
+ * older than window_ns, so that a report always has a complete window */
+struct NatsLatHist {
+  hdr_histogram * cur,
+                * prev;
+  uint64_t        window_start,
+                  window_ns;
+
+  bool init( uint64_t win_ns ) noexcept;
+  void release( void ) noexcept;
+  void rotate( uint64_t now ) noexcept;
+  void record( uint64_t now,  uint64_t lat ) noexcept {
+    if ( now - this->window_start >= this->window_ns )
+      this->rotate( now );
+    this->record_value( lat );
+  }
+  void record_value( uint64_t lat ) noexcept;
+};
+
+/* per connection latencies, allocated when NATSMD_LATENCY is set */
+struct NatsLatency {
+  NatsLatHist fwd,         /* frame parsed to forward_msg() completion */
+              write;       /* on_msg() to write completion */
+  uint64_t    write_stamp; /* oldest delivery not yet written */
+
+  static NatsLatency *create( uint64_t win_ns ) noexcept;
+  void release( void ) noexcept;
+  /* a msg was appended, stamp if first since the last write */
+  void deliver( void ) {
+    if ( this->write_stamp == 0 )
+      this->write_stamp = kv_current_monotonic_time_ns();
+  }
+};
+
+/* a growable output buffer used to format replies */
+struct NatsSysBuf {
+  char * buf;
+  size_t off,
+         len;
+
+  NatsSysBuf() : buf( 0 ), off( 0 ), len( 0 ) {}
+  ~NatsSysBuf() {
+    if ( this->buf != NULL )
+      ::free( this->buf );
+  }
+  bool make( size_t sz ) noexcept;
+  NatsSysBuf &b( const void *s,  size_t sz ) noexcept;
+  NatsSysBuf &s( const char *s ) noexcept {
+    return this->b( s, ::strlen( s ) );
+  }
+  NatsSysBuf &c( char c ) noexcept {
+    return this->b( &c, 1 );
+  }
+  NatsSysBuf &u( uint64_t n ) noexcept;
+  NatsSysBuf &i( int64_t n ) noexcept;
+  /* a json string with quotes, escaping control chars */
+  NatsSysBuf &q( const char *s,  size_t sz ) noexcept;
+  /* "name":n, */
+  NatsSysBuf &fld( const char *name,  uint64_t n ) noexcept {
+    return this->c( '\"' ).s( name ).s( "\":" ).u( n ).c( ',' );
+  }
+  /* "name":true, */
+  NatsSysBuf &bol( const char *name,  bool b ) noexcept {
+    return this->c( '\"' ).s( name ).s( b ? "\":true," : "\":false," );
+  }
+  /* "name":"str", */
+  NatsSysBuf &str( const char *name,  const char *s,  size_t sz ) noexcept {
+    return this->c( '\"' ).s( name ).s( "\":" ).q( s, sz ).c( ',' );
+  }
+  /* "name":[ n, n, n ], */
+  NatsSysBuf &arr( const char *name,  const uint32_t *n,  size_t cnt ) noexcept;
+  /* remove the trailing comma before closing } or ] */
+  NatsSysBuf &close( char c ) noexcept {
+    if ( this->off > 0 && this->buf[ this->off - 1 ] == ',' )
+      this->off--;
+    return this->c( c );
+  }
+  /* { "count": .. "chain_hist": [] } */
+  NatsSysBuf &tab_stats( const char *name,  const NatsTabStats &st ) noexcept;
+  /* { "count": .. "p50": .. "max": .. } */
+  NatsSysBuf &lat_hist( const char *name,  const hdr_histogram *h ) noexcept;
+};
+
+}
+}
+#endif
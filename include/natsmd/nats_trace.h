@@ -0,0 +1,115 @@
+#ifndef __rai_natsmd__nats_trace_h__
+#define __rai_natsmd__nats_trace_h__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <raikv/util.h>
+
+/* trace points are compiled only with -DNATSMD_TRACE, for example:
+ *
+ *   make DEFINES=-DNATSMD_TRACE
+ *
+ * and are recorded when nats_trace_on is set, either by NATSMD_TRACE=1 in
+ * the environment or by $SYS.REQ.<..>.TRACE {"enable":1}; each thread has a
+ * ring of the last RING_SIZE records which is written to a file by
+ * nats_trace_dump() and converted by test/nats_trace_dump.cpp */
+
+namespace rai {
+namespace natsmd {
+
+enum NatsTracePoint {
+  NATS_TR_PROCESS    = 0, /* EvNatsService::process() */
+  NATS_TR_PARSE_MSG  = 1, /* NatsMsg::parse_msg() */
+  NATS_TR_FWD_PUB    = 2, /* EvNatsService::fwd_pub() */
+  NATS_TR_ON_MSG     = 3, /* EvNatsService::on_msg() */
+  NATS_TR_FWD_MSG    = 4, /* EvNatsService::fwd_msg() */
+  NATS_TR_PUSH_WRITE = 5, /* EvConnection::push_write() from process() */
+  NATS_TR_WRITE      = 6, /* EvNatsService::write() */
+  NATS_TR_MAX        = 7
+};
+
+enum NatsTraceType {
+  NATS_TR_ENTER = 0,
+  NATS_TR_EXIT  = 1
+};
+
+static inline const char *
+nats_trace_point_name( uint16_t pt ) {
+  static const char *name[ NATS_TR_MAX ] = {
+    "process", "parse_msg", "fwd_pub", "on_msg", "fwd_msg", "push_write",
+    "write" };
+  return pt < NATS_TR_MAX ? name[ pt ] : "unknown";
+}
+
+struct NatsTraceRec {
+  uint64_t ns;     /* monotonic time */
+  uint32_t arg;    /* fd or size, depends on point */
+  uint16_t point,  /* NatsTracePoint */
+           type;   /* NatsTraceType */
+};
+
+struct NatsTraceRing {
+  static const size_t RING_SIZE = 64 * 1024; /* power of 2 */
+  uint64_t     head;  /* next rec, head - RING_SIZE is oldest if wrapped */
+  uint32_t     id;    /* thread ring number */
+  NatsTraceRec rec[ RING_SIZE ];
+};
+
+/* the file written by nats_trace_dump(), followed by count records */
+struct NatsTraceFileHdr {
+  char     magic[ 8 ];  /* NATS_TRACE_MAGIC */
+  uint32_t version,     /* 1 */
+           rec_size,    /* sizeof( NatsTraceRec ) */
+           count,       /* records following */
+           id;          /* ring id */
+  uint64_t lost;        /* records overwritten before dump */
+};
+static const char NATS_TRACE_MAGIC[ 8 ] = "NATSTRC";
+
+extern uint32_t nats_trace_on;
+extern thread_local NatsTraceRing * nats_trace_tls;
+
+NatsTraceRing *nats_trace_ring_create( void ) noexcept;
+/* write the ring of the calling thread to path, return records written */
+int nats_trace_dump( const char *path ) noexcept;
+
+static inline void
+nats_trace_rec( uint16_t pt,  uint16_t type,  uint32_t arg ) {
+  NatsTraceRing * r = nats_trace_tls;
+  if ( r == NULL && (r = nats_trace_ring_create()) == NULL )
+    return;
+  NatsTraceRec & x = r->rec[ r->head++ & ( NatsTraceRing::RING_SIZE - 1 ) ];
+  x.ns    = kv_current_monotonic_time_ns();
+  x.arg   = arg;
+  x.point = pt;
+  x.type  = type;
+}
+
+/* record enter and exit of a scope, exit only if enter was recorded */
+struct NatsTraceScope {
+  uint16_t pt;
+  bool     on;
+  NatsTraceScope( uint16_t p,  uint32_t arg )
+      : pt( p ), on( nats_trace_on != 0 ) {
+    if ( kv_unlikely( this->on ) )
+      nats_trace_rec( p, NATS_TR_ENTER, arg );
+  }
+  ~NatsTraceScope() {
+    if ( kv_unlikely( this->on ) )
+      nats_trace_rec( this->pt, NATS_TR_EXIT, 0 );
+  }
+};
+
+#define NATS_TRACE_CAT2( x, y ) x ## y
+#define NATS_TRACE_CAT( x, y ) NATS_TRACE_CAT2( x, y )
+#ifdef NATSMD_TRACE
+#define NATS_TRACE_SCOPE( pt, arg ) \
+  rai::natsmd::NatsTraceScope NATS_TRACE_CAT( nats_trace_scope_, __LINE__ )( \
+    pt, (uint32_t) ( arg ) )
+#else
+#define NATS_TRACE_SCOPE( pt, arg ) do { } while ( 0 )
+#endif
+
+}
+}
+#endif
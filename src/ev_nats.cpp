@@ -9,10 +9,17 @@
 #include <sys/socket.h>
 #include <netdb.h>
 #include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #else
 #include <raikv/win.h>
 #endif
 #include <natsmd/ev_nats.h>
+#include <natsmd/nats_sys.h>
+#include <natsmd/nats_hot.h>
+#include <natsmd/nats_trace.h>
+#include <natsmd/nats_metrics.h>
+#include <natsmd/nats_json.h>
 #include <raikv/key_hash.h>
 #include <raikv/util.h>
 #include <raikv/ev_publish.h>
@@ -20,6 +27,8 @@
 #include <pcre2.h>
 #include <raikv/pattern_cvt.h>
 #include <raimd/json_msg.h>
+#include <raimd/rv_msg.h>
+#include <raimd/tib_msg.h>
 
 uint32_t rai::natsmd::nats_debug = 0;
 
@@ -50,17 +59,120 @@ nats_create_listener( rai::kv::EvPoll *p,  rai::kv::RoutePublish *sr,
 
 EvNatsListen::EvNatsListen( EvPoll &p ) noexcept
   : EvTcpListen( p, "nats_listen", "nats_sock" ), sub_route( p.sub_route ),
-    host( 0 ), prefix_len( 0 ), svc( 0 ) {}
+    host( 0 ), prefix_len( 0 ), svc( 0 )
+{
+  this->init_config();
+}
 
 EvNatsListen::EvNatsListen( EvPoll &p,  RoutePublish &sr ) noexcept
   : EvTcpListen( p, "nats_listen", "nats_sock" ), sub_route( sr ),
-    host( 0 ), prefix_len( 0 ), svc( 0 ) {}
+    host( 0 ), prefix_len( 0 ), svc( 0 )
+{
+  this->init_config();
+}
+
+static bool
+getenv_bool( const char *var,  bool dflt )
+{
+  const char *val = ::getenv( var );
+  if ( val == NULL )
+    return dflt;
+  return val[ 0 ] != 'f' && val[ 0 ] != '0';
+}
+
+/* options from the environment:
+ *   NATSMD_LATENCY=<secs>       latency histogram window, LATZ
+ *   NATSMD_STAMP_HDR=1          add Nats-Recv-Ns, Nats-Deliver-Ns headers
+ *   NATSMD_HOT=<n>              HOTZ subject tracking of one msg in n,
+ *                               1 is every msg, not tracked when unset
+ *   NATSMD_MAX_PENDING=<bytes>  slow consumer limit of a connection
+ *   NATSMD_SLOW_POLICY=stall|drop|close  what happens over the limit,
+ *                               stall waits for send_highwater too
+ *   NATSMD_TRACE=1              record trace points, if built with them
+ *   NATSMD_METRICS_PORT=<port>  http listener for prometheus /metrics
+ *   NATSMD_ZEROCOPY_MIN=<bytes> msgs at least this size are not copied to
+ *                               the send buffer, they are written from the
+ *                               publisher's buffer; the kernel still copies,
+ *                               MSG_ZEROCOPY is not used (recv_highwater)
+ *   NATSMD_FLUSH_USECS=<usecs>  coalesce msgs for up to usecs before write
+ *   NATSMD_FLUSH_BYTES=<bytes>  or until this many are pending (65536)
+ *   NATSMD_FLUSH_CORK=1         set TCP_CORK while coalescing
+ *   NATSMD_DELTA_REFRESH=<msgs> full image every msgs with delta (32)
+ *   NATSMD_DELTA_BYTES=<bytes>  delta images of a connection, the least
+ *                               recently used are dropped over (4194304)
+ *   NATSMD_SYS_USER=<user>      only this CONNECT user may $SYS.REQ, when
+ *                               not set the requests are forwarded as pubs
+ *   NATSMD_SYS_PASS=<pass>      and the CONNECT pass must match
+ *   NATSMD_TRACE_DIR=<dir>      where TRACE {"dump":1} writes, no dumps
+ *                               when not set */
+void
+EvNatsListen::init_config( void ) noexcept
+{
+  this->stats.zero();
+  this->stats.start_ns = kv_current_realtime_ns();
+  this->lat_window_ns  = nats_latency_window_ns();
+  this->metrics        = NULL;
+  this->stamp_hdr      = getenv_bool( "NATSMD_STAMP_HDR", false );
+  if ( getenv_bool( "NATSMD_TRACE", false ) )
+    nats_trace_on = 1;
+  const char * val     = ::getenv( "NATSMD_HOT" );
+  uint32_t     sample  = ( val == NULL ? 0 :
+                           ( val[ 0 ] == 't' || val[ 0 ] == 'y' ) ? 1 :
+                           (uint32_t) ::strtoul( val, NULL, 10 ) );
+  if ( sample != 0 ) {
+    this->hot_pub      = NatsHotTrack::create( sample );
+    this->hot_deliver  = NatsHotTrack::create( sample );
+  }
+  else {
+    this->hot_pub      = NULL;
+    this->hot_deliver  = NULL;
+  }
+  val                  = ::getenv( "NATSMD_MAX_PENDING" );
+  this->max_pending    = ( val == NULL ? 0 : ::strtoull( val, NULL, 10 ) );
+  this->slow_policy    = NATS_SLOW_STALL;
+  val                  = ::getenv( "NATSMD_ZEROCOPY_MIN" );
+  this->zero_copy_min  = ( val == NULL ? 0 : ::strtoull( val, NULL, 10 ) );
+  val                  = ::getenv( "NATSMD_FLUSH_USECS" );
+  this->flush_usecs    = ( val == NULL ? 0 : (uint32_t) ::atoi( val ) );
+  val                  = ::getenv( "NATSMD_FLUSH_BYTES" );
+  this->flush_bytes    = ( val == NULL ? 64 * 1024 :
+                           ::strtoull( val, NULL, 10 ) );
+  this->flush_cork     = getenv_bool( "NATSMD_FLUSH_CORK", false );
+  val                  = ::getenv( "NATSMD_DELTA_REFRESH" );
+  this->delta_refresh  = ( val == NULL ? 32 : (uint32_t) ::atoi( val ) );
+  val                  = ::getenv( "NATSMD_DELTA_BYTES" );
+  this->delta_bytes    = ( val == NULL ? 4 * 1024 * 1024 :
+                           ::strtoull( val, NULL, 10 ) );
+  this->sys_user       = ::getenv( "NATSMD_SYS_USER" );
+  this->sys_pass       = ::getenv( "NATSMD_SYS_PASS" );
+  this->trace_dir      = ::getenv( "NATSMD_TRACE_DIR" );
+  if ( (val = ::getenv( "NATSMD_SLOW_POLICY" )) != NULL ) {
+    if ( ::strcmp( val, "drop" ) == 0 )
+      this->slow_policy = NATS_SLOW_DROP;
+    else if ( ::strcmp( val, "close" ) == 0 )
+      this->slow_policy = NATS_SLOW_CLOSE;
+  }
+}
 
 int
 EvNatsListen::listen( const char *ip,  int port,  int opts ) noexcept
 {
-  return this->kv::EvTcpListen::listen2( ip, port, opts, "nats_listen",
-                                         this->sub_route.route_id );
+  int status = this->kv::EvTcpListen::listen2( ip, port, opts, "nats_listen",
+                                               this->sub_route.route_id );
+  const char * val = ::getenv( "NATSMD_METRICS_PORT" );
+  if ( status == 0 && val != NULL && this->metrics == NULL ) {
+    int mport = ::atoi( val );
+    if ( mport > 0 ) {
+      EvNatsMetricsListen * m =
+        new ( aligned_malloc( sizeof( EvNatsMetricsListen ) ) )
+        EvNatsMetricsListen( this->poll, *this );
+      if ( m->listen( ip, mport, opts ) == 0 )
+        this->metrics = m;
+      else
+        fprintf( stderr, "metrics listen port %d failed\n", mport );
+    }
+  }
+  return status;
 }
 
 void
@@ -121,6 +233,12 @@ static char nats_server_info[] =
       "\"max_payload\":1048576}\r\n";
 bool is_server_info_init;
 
+const char *
+rai::natsmd::nats_server_id( void ) noexcept
+{
+  return &nats_server_info[ 19 ];
+}
+
 static void
 init_server_info( uint64_t h1,  uint64_t h2,  uint16_t port )
 {
@@ -209,6 +327,15 @@ EvNatsListen::accept( void ) noexcept
     init_server_info( h1, h2, port );
   }
   c->initialize_state( NULL, 0, ++this->timer_id );
+  c->max_pending = this->max_pending;
+  c->slow_policy = this->slow_policy;
+  c->zero_copy_min = this->zero_copy_min;
+  c->flush_usecs   = this->flush_usecs;
+  c->flush_bytes   = this->flush_bytes;
+  c->flush_cork    = this->flush_cork;
+  this->stats.accept_cnt++;
+  if ( this->lat_window_ns != 0 && c->lat == NULL )
+    c->lat = NatsLatency::create( this->lat_window_ns );
   c->set_prefix( this->prefix, this->prefix_len );
   c->append_iov( nats_server_info, sizeof( nats_server_info ) - 1 );
   c->idle_push( EV_WRITE_HI );
@@ -237,7 +364,9 @@ EvNatsService::process( void ) noexcept
                     err[]  = "-ERR\r\n",
                     pong[] = "PONG\r\n";
   const int verb_ok = ( this->user.verbose ? DO_OK : 0 );
+  uint64_t  start   = 0;
   int flow;
+  NATS_TRACE_SCOPE( NATS_TR_PROCESS, this->fd );
 
   if ( this->len - this->off > this->recv_highwater )
     this->nats_state |= NATS_BUFFERSIZE;
@@ -248,6 +377,8 @@ EvNatsService::process( void ) noexcept
       break;
 
     NatsMsg msg;
+    if ( this->lat != NULL )
+      start = kv_current_monotonic_time_ns();
     int fl = msg.parse_msg( &this->recv[ this->off ], &this->recv[ this->len ]);
     if ( fl == NEED_MORE ) {
       if ( msg.size > 0 )
@@ -270,10 +401,15 @@ EvNatsService::process( void ) noexcept
       case PUB_MSG:
       case HPUB_MSG:
         flow = this->fwd_pub( msg );
+        if ( this->lat != NULL ) {
+          uint64_t now = kv_current_monotonic_time_ns();
+          this->lat->fwd.record( now, now - start );
+        }
         if ( flow == NATS_FLOW_GOOD )
           this->nats_state &= ~NATS_BACKPRESSURE;
         else {
           this->nats_state |= NATS_BACKPRESSURE;
+          this->backpressure_cnt++;
           if ( flow == NATS_FLOW_STALLED ) {
             this->pop( EV_PROCESS );
             this->pop3( EV_READ, EV_READ_LO, EV_READ_HI );
@@ -308,6 +444,7 @@ EvNatsService::process( void ) noexcept
       this->append( err, sizeof( err ) - 1 );
   }
   this->pop( EV_PROCESS );
+  NATS_TRACE_SCOPE( NATS_TR_PUSH_WRITE, this->pending() );
   if ( ! this->push_write() )
     this->clear_write_buffers();
 }
@@ -315,6 +452,7 @@ EvNatsService::process( void ) noexcept
 int
 NatsMsg::parse_msg( char *start,  char *end ) noexcept
 {
+  NATS_TRACE_SCOPE( NATS_TR_PARSE_MSG, end - start );
   char * eol    = (char *) ::memchr( start, '\n', end - start );
   char * size_start, * p;
   size_t linesz, nargs, size_len;
@@ -343,9 +481,14 @@ NatsMsg::parse_msg( char *start,  char *end ) noexcept
     case NATS_KW_ERR:
       return IS_ERR;
 
-    case NATS_KW_SUB1:   /* SUB <subject> [queue group] <sid> */
+    case NATS_KW_SUB1:   /* SUB <subject> [queue group] <sid> [{fields}] */
     case NATS_KW_SUB2:
       nargs = args.parse( &start[ 4 ], eol );
+      if ( nargs >= 3 && args.ptr[ nargs - 1 ][ 0 ] == '{' ) {
+        nargs--;
+        this->fields     = args.ptr[ nargs ];
+        this->fields_len = args.len[ nargs ];
+      }
       if ( nargs < 2 || nargs > 3 )
         return DO_ERR;
 
@@ -527,6 +670,8 @@ EvNatsService::add_sub( NatsMsg &msg ) noexcept
   size_t       quelen    = msg.queue_len;
   uint32_t     quehash   = 0;
 
+  this->map_gen++;
+
   if ( preflen > 0 ) {
     CatPtr tmp( this->alloc_temp( sublen + preflen + 1 ) );
     tmp.x( this->prefix, preflen ).x( sub, sublen ).end();
@@ -625,6 +770,234 @@ EvNatsService::add_sub( NatsMsg &msg ) noexcept
     fprintf( stderr, "add_sub( %.*s, %.*s ) = %s\n",
              subj.len, subj.str, sid.len, sid.str, nats_status_str( status ) );
   }
+  else {
+    if ( msg.fields_len > 0 || this->proj_tab != NULL )
+      this->proj_set( sid, msg.fields, msg.fields_len );
+    if ( this->image_tab != NULL ) /* sid reused, client has no image */
+      this->delta_purge( sid );
+  }
+}
+
+void
+EvNatsService::proj_set( NatsStr &sid,  const char *fields,
+                         size_t len ) noexcept
+{
+  if ( len == 0 ) { /* resubscribed without a list */
+    this->proj_remove( sid );
+    return;
+  }
+  NatsFieldList * fl = NatsFieldList::create( fields, len );
+  if ( fl == NULL ) {
+    fprintf( stderr, "sid %.*s bad field list %.*s\n", sid.len, sid.str,
+             (int) len, fields );
+    return;
+  }
+  if ( this->proj_tab == NULL )
+    this->proj_tab = new NatsProjTab();
+  RouteLoc        loc;
+  NatsProjEntry * e = this->proj_tab->upsert( sid.hash(), sid.str, sid.len,
+                                              loc );
+  if ( e == NULL ) {
+    ::free( fl );
+    return;
+  }
+  if ( ! loc.is_new )
+    ::free( e->fields );
+  e->fields = fl;
+}
+
+void
+EvNatsService::proj_remove( NatsStr &sid ) noexcept
+{
+  RouteLoc        loc;
+  NatsProjEntry * e;
+
+  if ( this->proj_tab == NULL )
+    return;
+  if ( (e = this->proj_tab->find( sid.hash(), sid.str, sid.len,
+                                  loc )) != NULL ) {
+    ::free( e->fields );
+    this->proj_tab->remove( loc );
+  }
+}
+
+NatsFieldImage *
+EvNatsService::delta_image( const char *sub,  size_t sublen,  const char *sid,
+                            size_t sid_len ) noexcept
+{
+  char     key[ 256 ];
+  size_t   keylen = sublen + 1 + sid_len;
+  RouteLoc loc;
+
+  if ( keylen > sizeof( key ) )
+    return NULL;
+  ::memcpy( key, sub, sublen );
+  key[ sublen ] = ' ';
+  ::memcpy( &key[ sublen + 1 ], sid, sid_len );
+  if ( this->image_tab == NULL )
+    this->image_tab = new NatsImageTab();
+  NatsFieldImage * img = this->image_tab->upsert( kv_crc_c( key, keylen, 0 ),
+                                                  key, keylen, loc );
+  if ( img != NULL && loc.is_new ) {
+    img->buf        = NULL;
+    img->used       = 0;
+    img->buf_len    = 0;
+    img->buf_size   = 0;
+    img->update_cnt = 0;
+    img->full_len   = 0;
+    this->image_bytes += keylen;
+  }
+  return img;
+}
+
+/* save the key of img to remove after the scan, and free its fields */
+static bool
+save_image_key( char *&keys,  size_t &off,  NatsFieldImage *img ) noexcept
+{
+  size_t n = img->len;
+  char * p = (char *) ::realloc( keys, off + 6 + n );
+  if ( p == NULL )
+    return false;
+  keys = p;
+  ::memcpy( &keys[ off ], &img->hash, 4 );
+  ::memcpy( &keys[ off + 4 ], &img->len, 2 );
+  ::memcpy( &keys[ off + 6 ], img->value, n );
+  off += 6 + n;
+  if ( img->buf != NULL )
+    ::free( img->buf );
+  img->buf = NULL;
+  return true;
+}
+
+static void
+remove_image_keys( NatsImageTab &tab,  char *keys,  size_t off ) noexcept
+{
+  for ( size_t i = 0; i < off; ) {
+    uint32_t h;
+    uint16_t n;
+    ::memcpy( &h, &keys[ i ], 4 );
+    ::memcpy( &n, &keys[ i + 4 ], 2 );
+    tab.remove( h, &keys[ i + 6 ], n );
+    i += 6 + n;
+  }
+  if ( keys != NULL )
+    ::free( keys );
+}
+
+/* remove the images of <subject> <sid>, a wildcard sid may have many */
+void
+EvNatsService::delta_purge( NatsStr &sid ) noexcept
+{
+  RouteLoc         loc;
+  NatsFieldImage * img;
+  char           * keys = NULL;
+  size_t           off  = 0;
+
+  if ( this->image_tab == NULL )
+    return;
+  for ( img = this->image_tab->first( loc ); img != NULL;
+        img = this->image_tab->next( loc ) ) {
+    size_t n = img->len;
+    if ( n > sid.len && img->value[ n - sid.len - 1 ] == ' ' &&
+         ::memcmp( &img->value[ n - sid.len ], sid.str, sid.len ) == 0 ) {
+      uint64_t size = img->buf_size + n;
+      if ( ! save_image_key( keys, off, img ) )
+        break;
+      this->image_bytes -= size;
+    }
+  }
+  remove_image_keys( *this->image_tab, keys, off );
+}
+
+struct NatsImageAge {
+  uint64_t used, size;
+};
+
+static int
+cmp_image_age( const void *x,  const void *y ) noexcept
+{
+  const NatsImageAge * a = (const NatsImageAge *) x,
+                     * b = (const NatsImageAge *) y;
+  return a->used < b->used ? -1 : a->used > b->used ? 1 : 0;
+}
+
+/* remove the oldest images until under 3/4 of delta_bytes, so the sort is
+ * not done for every msg, the sids of those are sent in full next */
+void
+EvNatsService::delta_evict( void ) noexcept
+{
+  RouteLoc         loc;
+  NatsFieldImage * img;
+  char           * keys  = NULL;
+  size_t           off   = 0,
+                   cnt   = this->image_tab->pop_count(),
+                   i     = 0;
+  uint64_t         low   = this->listen.delta_bytes / 4 * 3,
+                   freed = 0,
+                   cut   = 0;
+  NatsImageAge   * age   = (NatsImageAge *)
+                           ::malloc( sizeof( NatsImageAge ) * ( cnt + 1 ) );
+  if ( age == NULL )
+    return;
+  for ( img = this->image_tab->first( loc ); img != NULL && i < cnt;
+        img = this->image_tab->next( loc ) ) {
+    age[ i ].used   = img->used;
+    age[ i++ ].size = img->buf_size + img->len;
+  }
+  ::qsort( age, i, sizeof( age[ 0 ] ), cmp_image_age );
+  for ( size_t j = 0; j < i; j++ ) {
+    cut    = age[ j ].used;
+    freed += age[ j ].size;
+    if ( freed >= this->image_bytes || this->image_bytes - freed <= low )
+      break;
+  }
+  ::free( age );
+  for ( img = this->image_tab->first( loc ); img != NULL;
+        img = this->image_tab->next( loc ) ) {
+    if ( img->used <= cut ) {
+      uint64_t size = img->buf_size + img->len;
+      if ( ! save_image_key( keys, off, img ) )
+        break;
+      this->image_bytes -= size;
+      this->delta_evicts++;
+    }
+  }
+  remove_image_keys( *this->image_tab, keys, off );
+}
+
+void
+EvNatsService::delta_release( void ) noexcept
+{
+  RouteLoc         loc;
+  NatsFieldImage * img;
+
+  if ( this->image_tab == NULL )
+    return;
+  for ( img = this->image_tab->first( loc ); img != NULL;
+        img = this->image_tab->next( loc ) ) {
+    if ( img->buf != NULL )
+      ::free( img->buf );
+  }
+  this->image_tab->release();
+  delete this->image_tab;
+  this->image_tab   = NULL;
+  this->image_bytes = 0;
+}
+
+void
+EvNatsService::proj_release( void ) noexcept
+{
+  RouteLoc        loc;
+  NatsProjEntry * e;
+
+  if ( this->proj_tab == NULL )
+    return;
+  for ( e = this->proj_tab->first( loc ); e != NULL;
+        e = this->proj_tab->next( loc ) )
+    ::free( e->fields );
+  this->proj_tab->release();
+  delete this->proj_tab;
+  this->proj_tab = NULL;
 }
 
 void
@@ -635,7 +1008,12 @@ EvNatsService::rem_sid( NatsMsg &msg ) noexcept
   NatsSubStatus status;
   bool          coll = false;
 
+  this->map_gen++;
   status = this->map.unsub( sid, msg.max_msgs, look, coll );
+  if ( msg.max_msgs == 0 ) {
+    this->proj_remove( sid );
+    this->delta_purge( sid );
+  }
   if ( status != NATS_NOT_FOUND ) {
     if ( look.rt != NULL ) {
       NotifyQueue nsub( look.rt->value, look.rt->subj_len, NULL, 0, look.hash,
@@ -688,6 +1066,7 @@ EvNatsService::rem_all_sub( void ) noexcept
   NatsPatternRoute * p;
   SidEntry         * entry;
 
+  this->map_gen++;
   for ( r = this->map.sub_tab.first( loc ); r != NULL;
         r = this->map.sub_tab.next( loc ) ) {
     bool coll = this->map.sub_tab.rem_collision( r );
@@ -740,6 +1119,7 @@ EvNatsService::rem_all_sub( void ) noexcept
 int
 EvNatsService::fwd_pub( NatsMsg &msg ) noexcept
 {
+  NATS_TRACE_SCOPE( NATS_TR_FWD_PUB, msg.msg_len );
   size_t   preflen = this->prefix_len;
   const char * sub = msg.subject,
              * rep = msg.reply;
@@ -760,8 +1140,21 @@ EvNatsService::fwd_pub( NatsMsg &msg ) noexcept
   if ( is_nats_debug )
     printf( "fwd_pub sub=%.*s, rep=%.*s msg_len=%u\n",
             (int) sublen, sub, (int) replen, rep, (uint32_t) msg.msg_len );
+  /* requests for server stats are not forwarded, when from the admin */
+  if ( msg.subject[ 0 ] == '$' && replen > 0 &&
+       msg.subject_len > NATS_SYS_REQ_LEN &&
+       ::memcmp( msg.subject, NATS_SYS_REQ, NATS_SYS_REQ_LEN ) == 0 &&
+       this->sys_allowed() ) {
+    if ( this->sys_request( msg, rep, replen ) )
+      return NATS_FLOW_GOOD;
+  }
+
+  if ( this->listen.stamp_hdr )
+    this->stamp_recv( msg );
 
   uint32_t  h = kv_crc_c( sub, sublen, 0 );
+  if ( this->listen.hot_pub != NULL )
+    this->listen.hot_pub->add( h, sub, sublen, msg.msg_len );
   EvPublish pub( sub, sublen, rep, replen, msg.msg_ptr, msg.msg_len,
                  this->sub_route, *this, h, MD_STRING );
   pub.hdr_len = msg.hdr_len;
@@ -775,9 +1168,85 @@ EvNatsService::fwd_pub( NatsMsg &msg ) noexcept
   return NATS_FLOW_STALLED;
 }
 
+/* copy the msg with a Nats-Recv-Ns header, PUB becomes HPUB */
+void
+EvNatsService::stamp_recv( NatsMsg &msg ) noexcept
+{
+  size_t hsz  = nats_hdr_stamp_size( sizeof( NATS_HDR_RECV_NS ) - 1 );
+  char * buf  = this->alloc_temp( msg.msg_len + hsz );
+  size_t hlen = nats_hdr_stamp( buf, msg.msg_ptr, msg.hdr_len, NATS_HDR_RECV_NS,
+                                sizeof( NATS_HDR_RECV_NS ) - 1,
+                                kv_current_realtime_ns() );
+  ::memcpy( &buf[ hlen ], &msg.msg_ptr[ msg.hdr_len ],
+            msg.msg_len - msg.hdr_len );
+  msg.msg_len = msg.msg_len - msg.hdr_len + hlen;
+  msg.hdr_len = hlen;
+  msg.msg_ptr = buf;
+}
+
+size_t
+rai::natsmd::nats_hdr_stamp( char *out,  const char *hdr,  size_t hdr_len,
+                             const char *name,  size_t name_len,
+                             uint64_t ns ) noexcept
+{
+  size_t i = 0;
+  if ( hdr_len == 0 ) {
+    hdr = NATS_HDR_STATUS;
+    i   = NATS_HDR_STATUS_LEN;
+  }
+  else {
+    /* after the NATS/1.0 [status] line */
+    const char * eol = (const char *) ::memchr( hdr, '\n', hdr_len );
+    i = ( eol == NULL ? 0 : &eol[ 1 ] - hdr );
+  }
+  CatPtr p( out );
+  p.x( hdr, i ).x( name, name_len ).u( ns ).s( "\r\n" );
+  if ( hdr_len == 0 )
+    p.s( "\r\n" );
+  else
+    p.x( &hdr[ i ], hdr_len - i );
+  return p.len();
+}
+
+bool
+rai::natsmd::nats_hdr_is_recv_only( const char *hdr,  size_t hdr_len ) noexcept
+{
+  static const size_t name_len = sizeof( NATS_HDR_RECV_NS ) - 1;
+  size_t i = NATS_HDR_STATUS_LEN + name_len;
+  if ( hdr_len < i + 5 ||
+       ::memcmp( hdr, NATS_HDR_STATUS, NATS_HDR_STATUS_LEN ) != 0 ||
+       ::memcmp( &hdr[ NATS_HDR_STATUS_LEN ], NATS_HDR_RECV_NS,
+                 name_len ) != 0 )
+    return false;
+  while ( i < hdr_len && hdr[ i ] >= '0' && hdr[ i ] <= '9' )
+    i++;
+  return i + 4 == hdr_len && ::memcmp( &hdr[ i ], "\r\n\r\n", 4 ) == 0;
+}
+
+void
+NatsMsgTransform::stamp_deliver( bool headers ) noexcept
+{
+  if ( ! headers ) {
+    if ( this->hdr_len > 0 &&
+         nats_hdr_is_recv_only( (const char *) this->hdr, this->hdr_len ) ) {
+      this->hdr     = NULL;
+      this->hdr_len = 0;
+    }
+    return;
+  }
+  size_t name_len = sizeof( NATS_HDR_DELIVER_NS ) - 1;
+  char * buf = this->spc.str_make( this->hdr_len +
+                                   nats_hdr_stamp_size( name_len ) );
+  this->hdr_len = (uint32_t)
+    nats_hdr_stamp( buf, (const char *) this->hdr, this->hdr_len,
+                    NATS_HDR_DELIVER_NS, name_len, kv_current_realtime_ns() );
+  this->hdr = buf;
+}
+
 bool
 EvNatsService::on_msg( EvPublish &pub ) noexcept
 {
+  NATS_TRACE_SCOPE( NATS_TR_ON_MSG, this->fd );
   NatsStr          subj, sid, pre;
   NatsLookup       look;
   NatsMsgTransform xf( pub, sid );
@@ -794,10 +1263,13 @@ EvNatsService::on_msg( EvPublish &pub ) noexcept
       subj.set( pub.subject, pub.subject_len, h );
       status = this->map.lookup_publish( subj, look );
       if ( status != NATS_NOT_FOUND ) { /* OK or EXPIRED */
+        xf.seq   = look.rt->msg_cnt;
+        xf.exact = true;
         for ( b = look.rt->first_sid( sid ); b; b = look.rt->next_sid( sid ) ) {
           flow_good &= this->fwd_msg( pub, xf );
         }
         if ( status == NATS_EXPIRED ) {
+          this->map_gen++;
           status = this->map.expired( look, coll );
           NotifyQueue nsub( subj.str, subj.len, NULL, 0, h, coll, 'N', *this,
                             NULL, 0, look.que_hash );
@@ -826,6 +1298,8 @@ EvNatsService::on_msg( EvPublish &pub ) noexcept
       for (;;) {
         if ( status == NATS_NOT_FOUND )
           break;
+        xf.seq   = look.match->msg_cnt;
+        xf.exact = false;
         for ( b = look.match->first_sid( sid ); b;
               b = look.match->next_sid( sid ) ) {
           if ( sid.len == 1 && sid.str[ 0 ] == 'I' )
@@ -833,6 +1307,7 @@ EvNatsService::on_msg( EvPublish &pub ) noexcept
           flow_good &= this->fwd_msg( pub, xf );
         }
         if ( status == NATS_EXPIRED ) {
+          this->map_gen++;
           status = this->map.expired_pattern( look, coll );
           PatternCvt cvt;
           NotifyPatternQueue npat( cvt, look.match->value, look.match->subj_len,
@@ -910,6 +1385,7 @@ EvNatsService::hash_to_sub( uint32_t h,  char *key,  size_t &keylen ) noexcept
 bool
 EvNatsService::fwd_msg( EvPublish &pub,  NatsMsgTransform &xf ) noexcept
 {
+  NATS_TRACE_SCOPE( NATS_TR_FWD_MSG, this->fd );
   const char  * sid  = xf.sid.str;
   size_t    sid_len  = xf.sid.len;
   const char  * sub  = pub.subject,
@@ -931,6 +1407,19 @@ EvNatsService::fwd_msg( EvPublish &pub,  NatsMsgTransform &xf ) noexcept
   if ( is_nats_debug )
     printf( "fwd_msg sub=%.*s, rep=%.*s msg_len=%u\n",
             (int) sublen, sub, (int) replen, rep, (uint32_t) pub.msg_len );
+  /* drop or close do not backpressure the publisher */
+  if ( ( this->nats_state & NATS_SLOW_CONSUMER ) != 0 )
+    return true;
+  if ( this->max_pending != 0 && this->pending() > this->max_pending ) {
+    if ( this->slow_policy == NATS_SLOW_DROP ) {
+      this->slow_drops++;
+      return true;
+    }
+    if ( this->slow_policy == NATS_SLOW_CLOSE ) {
+      this->slow_consumer();
+      return true;
+    }
+  }
   sublen -= preflen;
   sub     = &sub[ preflen ];
   if ( replen > 0 ) {
@@ -944,11 +1433,95 @@ EvNatsService::fwd_msg( EvPublish &pub,  NatsMsgTransform &xf ) noexcept
       if ( pub.pub_status <= EV_MAX_LOSS || pub.pub_status == EV_PUB_RESTART ) {
         if ( this->notify != NULL )
           this->notify->on_data_loss( *this, pub );
+        xf.loss = pub.pub_status;
+      }
+    }
+    if ( this->listen.stamp_hdr )
+      xf.stamp_deliver( this->user.headers );
+  }
+  /* a sid with a field list is sent only those fields, decoded from the
+   * msg as published and written in the encoding of the connection; with
+   * delta, json of the fields changed since the last msg to the sid; the
+   * msg is converted only if a sid sends all of it */
+  const void * data     = NULL;
+  uint32_t     data_len = 0;
+  bool         per_sid  = false;
+  NatsProjEntry * e = NULL;
+  if ( this->proj_tab != NULL )
+    e = this->proj_tab->find( xf.sid.hash(), sid, sid_len );
+  if ( e != NULL ) {
+    char  * out;
+    size_t  out_len;
+    if ( nats_project( xf.spc, &((const char *) pub.msg)[ pub.hdr_len ],
+                       pub.msg_len - pub.hdr_len, pub.msg_enc,
+                       this->user.encoding, *e->fields, out, out_len ) ) {
+      data     = out;
+      data_len = (uint32_t) out_len;
+      per_sid  = true;
+      this->proj_cnt++;
+    }
+  }
+  else if ( this->user.delta && this->user.encoding == NATS_ENC_JSON &&
+            pub.msg_len > pub.hdr_len ) {
+    NatsFieldImage * img = this->delta_image( sub, sublen, sid, sid_len );
+    char  * out;
+    size_t  out_len;
+    if ( img != NULL ) {
+      uint32_t refresh = this->listen.delta_refresh;
+      bool     full    = ( img->update_cnt == 0 ||
+                           ( refresh != 0 && img->update_cnt % refresh == 0 ) );
+      /* a conflated frame replaces the last, which may have a change */
+      if ( this->user.conflate && this->pending() > this->send_highwater )
+        full = true;
+      img->update_cnt++;
+      img->used = ++this->image_clock;
+      uint32_t size = img->buf_size;
+      if ( nats_delta( xf.spc, &((const char *) pub.msg)[ pub.hdr_len ],
+                       pub.msg_len - pub.hdr_len, *img, full, out,
+                       out_len ) ) {
+        data     = out;
+        data_len = (uint32_t) out_len;
+        per_sid  = true;
+        if ( full )
+          img->full_len = (uint32_t) out_len;
+        else {
+          this->delta_cnt++;
+          if ( img->full_len > out_len )
+            this->delta_saved += img->full_len - out_len;
+        }
       }
+      this->image_bytes += img->buf_size - size;
+      if ( this->listen.delta_bytes != 0 &&
+           this->image_bytes > this->listen.delta_bytes )
+        this->delta_evict();
+    }
+  }
+  if ( ! per_sid ) {
+    this->transform_msg( xf );
+    data     = xf.msg;
+    data_len = xf.msg_len;
+  }
+  /* Nats-Seq and Nats-Loss are inserted after the header status line */
+  char   seq_hdr[ 64 ];
+  size_t seq_len = 0,
+         status_len = 0,
+         hdr_len = xf.hdr_len;
+  if ( this->user.sequence && this->user.headers ) {
+    CatPtr q( seq_hdr );
+    q.s( NATS_HDR_SEQ ).u( xf.seq ).s( "\r\n" );
+    if ( xf.loss != 0 )
+      q.s( NATS_HDR_LOSS ).u( xf.loss ).s( "\r\n" );
+    seq_len = q.len();
+    if ( hdr_len == 0 )
+      hdr_len = NATS_HDR_STATUS_LEN + seq_len + 2;
+    else {
+      const char * eol = (const char *)
+        ::memchr( xf.hdr, '\n', xf.hdr_len );
+      status_len = ( eol == NULL ? 0 : &eol[ 1 ] - (const char *) xf.hdr );
+      hdr_len   += seq_len;
     }
-    xf.check_transform( this->user.binary );
   }
-  size_t msg_len_digits = uint64_digits( xf.msg_len + xf.hdr_len ),
+  size_t msg_len_digits = uint64_digits( data_len + hdr_len ),
          hdr_len_digits = 0,
          len;
 
@@ -957,63 +1530,418 @@ EvNatsService::fwd_msg( EvPublish &pub,  NatsMsgTransform &xf ) noexcept
         ( replen > 0 ? replen + 1 : 0 ) + /* [reply] */
         msg_len_digits + 2;    /* <size> \r\n */
 
-  if ( ! xf.is_converted && xf.msg_len + xf.hdr_len > this->recv_highwater ) {
-    if ( xf.idx_ref == 0 )
-      xf.idx_ref = this->poll.zero_copy_ref( pub.src_route.fd, xf.msg, xf.msg_len );
+  /* while backpressured, replace the previous msg of the subject */
+  bool conflate = false;
+  if ( this->user.conflate ) {
+    if ( this->pending() > this->send_highwater )
+      conflate = true;
+    else if ( this->conflate_cnt > 0 )
+      this->conflate_flush();
   }
-  if ( xf.idx_ref == 0 )
-    len += xf.msg_len + 2;        /* <blob> \r\n */
+  uint32_t     idx_ref = 0;
+  const char * shared  = NULL;
+  if ( ! conflate && ! per_sid ) {
+    uint64_t zmin = ( this->zero_copy_min != 0 ? this->zero_copy_min :
+                      this->recv_highwater + 1 );
+    if ( ! xf.is_converted && xf.msg_len + xf.hdr_len >= zmin ) {
+      if ( xf.idx_ref == 0 )
+        xf.idx_ref = this->poll.zero_copy_ref( pub.src_route.fd, xf.msg,
+                                               xf.msg_len );
+    }
+    idx_ref = xf.idx_ref;
+    /* another sid already queued the payload, only the header is new */
+    if ( idx_ref == 0 )
+      shared = xf.shared;
+  }
+  if ( idx_ref == 0 && shared == NULL )
+    len += data_len + 2;          /* <blob> \r\n */
 
-  if ( xf.hdr_len == 0 ) {
+  if ( hdr_len == 0 ) {
     len += 4; /* MSG */
   }
   else {
-    hdr_len_digits = uint64_digits( xf.hdr_len );
+    hdr_len_digits = uint64_digits( hdr_len );
     len += 5 +                  /* HMSG */
            hdr_len_digits + 1 + /* <hsize> */
-           xf.hdr_len;
+           hdr_len;
+  }
+  char * buf = NULL;
+  if ( conflate ) {
+    buf = this->conflate_frame( sub, sublen, sid, sid_len, len );
+    if ( buf == NULL ) /* queue it, idx_ref is zero, msg is copied */
+      conflate = false;
+  }
+  if ( buf == NULL )
+    buf = this->alloc_temp( len );
+  CatPtr p( buf );
+
+  size_t       pre_len = 0;
+  const char * pre     = NULL;
+  if ( xf.exact )
+    pre = this->msg_hdr( sub, sublen, sid, sid_len, pre_len );
+  if ( pre != NULL ) {
+    if ( hdr_len == 0 )
+      p.b( &pre[ 1 ], pre_len - 1 ); /* MSG <subject> <sid> */
+    else
+      p.b( pre, pre_len );
+  }
+  else {
+    if ( hdr_len == 0 )
+      p.s( "MSG " );
+    else
+      p.s( "HMSG " );
+    p.x( sub, sublen ).c( ' ' )
+     .x( sid, sid_len ).c( ' ' );
   }
-  CatPtr p( this->alloc_temp( len ) );
-
-  if ( xf.hdr_len == 0 )
-    p.s( "MSG " );
-  else
-    p.s( "HMSG " );
-  p.x( sub, sublen ).c( ' ' )
-   .x( sid, sid_len ).c( ' ' );
   if ( replen > 0 )
     p.x( rep, replen ).c( ' ' );
-  if ( xf.hdr_len > 0 )
-    p.u( xf.hdr_len, hdr_len_digits ).s( " " );
-  p.u( xf.msg_len + xf.hdr_len, msg_len_digits ).s( "\r\n" );
-  if ( xf.hdr_len > 0 )
-    p.b( xf.hdr, xf.hdr_len );
-
-  if ( xf.idx_ref == 0 ) {
-    p.b( xf.msg, xf.msg_len ).s( "\r\n" );
+  if ( hdr_len > 0 )
+    p.u( hdr_len, hdr_len_digits ).s( " " );
+  p.u( data_len + hdr_len, msg_len_digits ).s( "\r\n" );
+  if ( seq_len == 0 ) {
+    if ( hdr_len > 0 )
+      p.b( xf.hdr, hdr_len );
+  }
+  else if ( xf.hdr_len == 0 ) {
+    p.b( NATS_HDR_STATUS, NATS_HDR_STATUS_LEN ).b( seq_hdr, seq_len )
+     .s( "\r\n" );
+  }
+  else {
+    p.b( xf.hdr, status_len ).b( seq_hdr, seq_len )
+     .b( &((const char *) xf.hdr)[ status_len ], xf.hdr_len - status_len );
+  }
+
+  if ( conflate ) {
+    p.b( data, data_len ).s( "\r\n" );
+    return true;
+  }
+  if ( shared != NULL ) {
+    this->append_iov( p.start, len );
+    this->append_iov( shared, xf.msg_len + 2 );
+  }
+  else if ( idx_ref == 0 ) {
+    p.b( data, data_len ).s( "\r\n" );
     this->append_iov( p.start, len );
+    if ( ! per_sid && data_len >= NATS_SHARE_MIN_SIZE )
+      xf.shared = &p.start[ len - ( xf.msg_len + 2 ) ];
   }
   else {
-    this->append_ref_iov( p.start, len, xf.msg, xf.msg_len, xf.idx_ref, 2 );
+    this->append_ref_iov( p.start, len, xf.msg, xf.msg_len, idx_ref, 2 );
+    this->zero_ref_cnt++;
+    this->zero_ref_bytes += xf.msg_len;
   }
+  if ( this->lat != NULL )
+    this->lat->deliver();
+  if ( this->listen.hot_deliver != NULL )
+    this->listen.hot_deliver->add( pub.subj_hash, pub.subject,
+                                   pub.subject_len, data_len + hdr_len );
   this->msgs_sent++;
-  return this->idle_push_write();
+  if ( ! this->flush_msgs() )
+    return false;
+  /* stall policy, backpressure publisher when over the limit; the publisher
+   * is resumed when the write drains under send_highwater, so the stall is
+   * not reported until pending is over both, a lower limit waits for it */
+  return this->max_pending == 0 || this->pending() <= this->max_pending ||
+         this->pending() <= this->send_highwater;
+}
+
+NatsMsgHdrCache *
+NatsMsgHdrCache::create( void ) noexcept
+{
+  void * p = ::malloc( sizeof( NatsMsgHdrCache ) );
+  if ( p != NULL )
+    ::memset( p, 0, sizeof( NatsMsgHdrCache ) );
+  return (NatsMsgHdrCache *) p;
+}
+
+/* return "HMSG <subject> <sid> " from the cache, rendering it if the sid
+ * is not cached or the map changed, NULL if it is too large to cache */
+const char *
+EvNatsService::msg_hdr( const char *sub,  size_t sublen,  const char *sid,
+                        size_t sid_len,  size_t &len ) noexcept
+{
+  if ( sublen + sid_len + 7 > NatsMsgHdr::HDR_LEN )
+    return NULL;
+  if ( this->hdr_cache == NULL &&
+       (this->hdr_cache = NatsMsgHdrCache::create()) == NULL )
+    return NULL;
+  NatsMsgHdr & e = this->hdr_cache->get( sid );
+  if ( e.sid != sid || e.gen != this->map_gen ) {
+    CatPtr p( e.hdr );
+    p.s( "HMSG " ).x( sub, sublen ).c( ' ' ).x( sid, sid_len ).c( ' ' );
+    e.sid = sid;
+    e.gen = this->map_gen;
+    e.len = (uint16_t) p.len();
+  }
+  len = e.len;
+  return e.hdr;
+}
+
+/* without a flush policy, write when the poll loop is idle; with one,
+ * write when flush_bytes are pending or flush_usecs after the first msg,
+ * whichever is first, so that a burst is one write instead of many */
+bool
+EvNatsService::flush_msgs( void ) noexcept
+{
+  if ( this->flush_usecs == 0 || this->pending() >= this->flush_bytes )
+    return this->idle_push_write();
+  if ( ( this->nats_state & NATS_FLUSH_TIMER ) == 0 ) {
+    if ( ! this->poll.timer.add_timer_micros( this->fd, this->flush_usecs,
+                                              this->timer_id, NATS_FLUSH_EID ) )
+      return this->idle_push_write();
+    this->nats_state |= NATS_FLUSH_TIMER;
+    if ( this->flush_cork && ( this->nats_state & NATS_CORKED ) == 0 )
+      this->set_cork( true );
+  }
+  return true;
+}
+
+/* cork while a burst is coalesced, uncork when it is written */
+void
+EvNatsService::set_cork( bool on ) noexcept
+{
+#ifdef TCP_CORK
+  int val = ( on ? 1 : 0 );
+  if ( ::setsockopt( this->fd, IPPROTO_TCP, TCP_CORK, &val,
+                     sizeof( val ) ) == 0 ) {
+    if ( on )
+      this->nats_state |= NATS_CORKED;
+    else
+      this->nats_state &= ~NATS_CORKED;
+  }
+#else
+  (void) on;
+#endif
+}
+
+/* return the frame buffer of subject + sid, replacing the previous msg */
+char *
+EvNatsService::conflate_frame( const char *sub,  size_t sublen,
+                               const char *sid,  size_t sid_len,
+                               size_t len ) noexcept
+{
+  char     key[ 256 ];
+  size_t   keylen = sublen + 1 + sid_len;
+  RouteLoc loc;
+
+  if ( keylen > sizeof( key ) )
+    return NULL;
+  if ( this->conflate_tab == NULL )
+    this->conflate_tab = new NatsConflateTab();
+  CatPtr k( key );
+  k.x( sub, sublen ).c( ' ' ).x( sid, sid_len );
+  uint32_t h = kv_crc_c( key, keylen, 0 );
+  NatsConflate * c = this->conflate_tab->upsert( h, key, keylen, loc );
+  if ( c == NULL )
+    return NULL;
+  if ( loc.is_new ) {
+    c->frame      = NULL;
+    c->frame_len  = 0;
+    c->frame_size = 0;
+  }
+  if ( c->frame_len == 0 )
+    this->conflate_cnt++;
+  else
+    this->conflated++;
+  if ( len > c->frame_size ) {
+    void * p = ::realloc( c->frame, len );
+    if ( p == NULL ) {
+      if ( c->frame_len == 0 )
+        this->conflate_cnt--;
+      else
+        this->conflated--;
+      return NULL;
+    }
+    c->frame      = (char *) p;
+    c->frame_size = len;
+  }
+  c->frame_len = len;
+  return c->frame;
+}
+
+/* append the latest msgs kept while backpressured */
+void
+EvNatsService::conflate_flush( void ) noexcept
+{
+  RouteLoc       loc;
+  NatsConflate * c;
+
+  if ( this->conflate_tab == NULL )
+    return;
+  for ( c = this->conflate_tab->first( loc ); c != NULL;
+        c = this->conflate_tab->next( loc ) ) {
+    if ( c->frame_len > 0 ) {
+      this->append( c->frame, c->frame_len );
+      this->msgs_sent++;
+    }
+    if ( c->frame != NULL )
+      ::free( c->frame );
+  }
+  this->conflate_tab->release();
+  this->conflate_cnt = 0;
+  this->idle_push_write();
+}
+
+void
+EvNatsService::conflate_release( void ) noexcept
+{
+  RouteLoc       loc;
+  NatsConflate * c;
+
+  if ( this->conflate_tab == NULL )
+    return;
+  for ( c = this->conflate_tab->first( loc ); c != NULL;
+        c = this->conflate_tab->next( loc ) ) {
+    if ( c->frame != NULL )
+      ::free( c->frame );
+  }
+  this->conflate_tab->release();
+  delete this->conflate_tab;
+  this->conflate_tab = NULL;
+  this->conflate_cnt = 0;
+}
+
+/* send -ERR and close, the pending msgs are discarded */
+void
+EvNatsService::slow_consumer( void ) noexcept
+{
+  static const char slow_err[] = "-ERR 'Slow Consumer'\r\n";
+  if ( ( this->nats_state & NATS_SLOW_CONSUMER ) != 0 )
+    return;
+  this->nats_state |= NATS_SLOW_CONSUMER;
+  this->listen.stats.slow_closes++;
+  if ( is_nats_debug )
+    printf( "slow consumer fd %d pending %" PRIu64 "\n", this->fd,
+            (uint64_t) this->pending() );
+  this->clear_write_buffers();
+  this->append( slow_err, sizeof( slow_err ) - 1 );
+  this->pop3( EV_READ, EV_READ_HI, EV_READ_LO );
+  this->push( EV_WRITE_HI );
+  this->push( EV_SHUTDOWN );
+}
+
+static bool
+xf_resize( char *&buf,  size_t &buf_size,  size_t len ) noexcept
+{
+  if ( len <= buf_size )
+    return true;
+  size_t sz = ( buf_size == 0 ? 1024 : buf_size );
+  while ( sz < len )
+    sz *= 2;
+  char * p = (char *) ::realloc( buf, sz );
+  if ( p == NULL )
+    return false;
+  buf      = p;
+  buf_size = sz;
+  return true;
+}
+
+bool
+NatsXfCache::make( size_t len,  size_t src_len ) noexcept
+{
+  return xf_resize( this->buf, this->buf_size, len ) &&
+         xf_resize( this->src, this->src_size, src_len );
+}
+
+bool
+NatsXfCache::convert( MDMsg &m,  MDMsgMem &spc,  size_t len,  uint8_t fmt,
+                      char *&out,  size_t &out_len ) noexcept
+{
+  size_t limit   = ( ( len | 15 ) + 1 ) * ( MAX_RATIO8 / 8 ),
+         max_len = this->estimate( len );
+  for (;;) {
+    if ( max_len > limit )
+      max_len = limit;
+    char * start = spc.str_make( max_len );
+    bool   ok;
+    switch ( fmt ) {
+      case NATS_ENC_RV: {
+        RvMsgWriter rvmsg( spc, start, max_len );
+        ok = ( rvmsg.convert_msg( m ) == 0 );
+        if ( ok ) {
+          out_len = rvmsg.update_hdr();
+          out     = (char *) rvmsg.buf;
+        }
+        break;
+      }
+      case NATS_ENC_TIBMSG: {
+        TibMsgWriter tibmsg( spc, start, max_len );
+        ok = ( tibmsg.convert_msg( m ) == 0 );
+        if ( ok ) {
+          out_len = tibmsg.update_hdr();
+          out     = (char *) tibmsg.buf;
+        }
+        break;
+      }
+      default: {
+        NatsJsonWriter jmsg( spc, start, max_len );
+        ok = ( jmsg.convert_msg( m ) == 0 && jmsg.finish() );
+        if ( ok ) {
+          out_len = jmsg.off;
+          out     = jmsg.buf;
+        }
+        break;
+      }
+    }
+    if ( ok ) {
+      this->learn( len, out_len );
+      return true;
+    }
+    /* the writer does not say why, a msg that fails at the limit fails */
+    if ( max_len == limit )
+      return false;
+    this->grows++;
+    max_len *= 2;
+  }
 }
 
 void
-NatsMsgTransform::transform( void ) noexcept
+NatsMsgTransform::transform( NatsXfCache &cache,  uint8_t fmt ) noexcept
 {
+  /* already in the format, deliver as published */
+  if ( ( fmt == NATS_ENC_RV && this->msg_enc == RVMSG_TYPE_ID ) ||
+       ( fmt == NATS_ENC_TIBMSG && this->msg_enc == TIBMSG_TYPE_ID ) )
+    return;
+  if ( cache.equals( this->msg, this->msg_len, this->msg_enc ) ) {
+    cache.hits++;
+    if ( cache.ok ) {
+      this->msg     = cache.buf;
+      this->msg_len = (uint32_t) cache.buf_len;
+      this->is_converted = true;
+    }
+    return;
+  }
+  cache.misses++;
+  bool   ok = false;
+  char * out = NULL;
+  size_t out_len = 0;
   MDMsg * m = MDMsg::unpack( (void *) this->msg, 0, this->msg_len, 0,
                              NULL, this->spc );
-  if ( m == NULL )
+  if ( m != NULL && cache.convert( *m, this->spc, this->msg_len, fmt, out,
+                                   out_len ) )
+    ok = true;
+  /* copy to cache, spc is released when on_msg() returns */
+  if ( ! cache.make( out_len, this->msg_len ) ) {
+    cache.msg_len = 0; /* no cache, but use the result */
+    cache.msg_enc = 0;
+    if ( ok ) {
+      this->msg     = out;
+      this->msg_len = (uint32_t) out_len;
+      this->is_converted = true;
+    }
     return;
-
-  size_t max_len = ( ( this->msg_len | 15 ) + 1 ) * 16;
-  char * start = this->spc.str_make( max_len );
-  JsonMsgWriter jmsg( this->spc, start, max_len );
-  if ( jmsg.convert_msg( *m ) == 0 && jmsg.finish() ) {
-    this->msg     = jmsg.buf;
-    this->msg_len = jmsg.off;
+  }
+  if ( ok ) {
+    ::memcpy( cache.buf, out, out_len );
+    cache.buf_len = out_len;
+  }
+  ::memcpy( cache.src, this->msg, this->msg_len );
+  cache.msg_len = this->msg_len;
+  cache.msg_enc = this->msg_enc;
+  cache.ok      = ok;
+  if ( ok ) {
+    this->msg     = cache.buf;
+    this->msg_len = (uint32_t) cache.buf_len;
     this->is_converted = true;
   }
 }
@@ -1021,6 +1949,20 @@ NatsMsgTransform::transform( void ) noexcept
 void
 EvNatsService::process_close( void ) noexcept
 {
+  NatsListenStats & st = this->listen.stats;
+  st.close_cnt++;
+  st.msgs_recv  += this->msgs_recv;
+  st.msgs_sent  += this->msgs_sent;
+  st.bytes_recv += this->bytes_recv;
+  st.bytes_sent += this->bytes_sent;
+  st.slow_drops += this->slow_drops;
+  st.backpressure += this->backpressure_cnt;
+  st.converts   += this->convert_cnt;
+  st.zero_refs  += this->zero_ref_cnt;
+  st.zero_ref_bytes += this->zero_ref_bytes;
+  st.flush_timers += this->flush_timer_cnt;
+  st.read_calls += this->read_calls;
+  st.write_calls += this->write_calls;
   this->client_stats( this->sub_route.peer_stats );
   this->EvSocket::process_close();
 }
@@ -1030,6 +1972,8 @@ EvNatsService::release( void ) noexcept
 {
   if ( ( this->nats_state & NATS_HAS_TIMER ) != 0 )
     this->poll.timer.remove_timer( this->fd, this->timer_id, 0 );
+  if ( ( this->nats_state & NATS_FLUSH_TIMER ) != 0 )
+    this->poll.timer.remove_timer( this->fd, this->timer_id, NATS_FLUSH_EID );
   if ( this->bp_in_list() )
     this->bp_retire( *this );
   this->rem_all_sub();
@@ -1039,11 +1983,30 @@ EvNatsService::release( void ) noexcept
   this->EvConnection::release_buffers();
   this->user.release();
   this->timer_id = 0;
+  if ( this->lat != NULL ) {
+    this->lat->release();
+    this->lat = NULL;
+  }
+  this->conflate_release();
+  this->proj_release();
+  this->delta_release();
+  if ( this->hdr_cache != NULL ) {
+    ::free( this->hdr_cache );
+    this->hdr_cache = NULL;
+  }
 }
 
 bool
-EvNatsService::timer_expire( uint64_t tid, uint64_t ) noexcept
+EvNatsService::timer_expire( uint64_t tid, uint64_t eid ) noexcept
 {
+  if ( eid == NATS_FLUSH_EID ) {
+    this->nats_state &= ~NATS_FLUSH_TIMER;
+    if ( tid == this->timer_id && this->pending() > 0 ) {
+      this->flush_timer_cnt++;
+      this->idle_push_write();
+    }
+    return false;
+  }
   if ( tid == this->timer_id ) {
     this->nats_state &= ~NATS_HAS_TIMER;
     this->push( EV_PROCESS );
@@ -1055,6 +2018,8 @@ EvNatsService::timer_expire( uint64_t tid, uint64_t ) noexcept
 void
 EvNatsService::on_write_ready( void ) noexcept
 {
+  if ( this->conflate_cnt > 0 )
+    this->conflate_flush();
   this->push( EV_PROCESS );
   this->idle_push( EV_READ_LO );
 }
@@ -1063,16 +2028,39 @@ void
 EvNatsService::read( void ) noexcept
 {
   if ( ! this->bp_in_list() ) {
+    this->read_calls++;
     this->EvConnection::read();
     return;
   }
   this->pop3( EV_READ, EV_READ_HI, EV_READ_LO );
 }
 
+void
+EvNatsService::write( void ) noexcept
+{
+  {
+    NATS_TRACE_SCOPE( NATS_TR_WRITE, this->pending() );
+    this->write_calls++;
+    this->EvConnection::write();
+  }
+  if ( ( this->nats_state & NATS_CORKED ) != 0 && this->pending() == 0 )
+    this->set_cork( false );
+  /* oldest msg appended since the last flush is now written */
+  if ( this->lat != NULL && this->lat->write_stamp != 0 &&
+       this->pending() == 0 ) {
+    uint64_t now = kv_current_monotonic_time_ns();
+    this->lat->write.record( now, now - this->lat->write_stamp );
+    this->lat->write_stamp = 0;
+  }
+  if ( this->conflate_cnt > 0 && this->pending() <= this->send_highwater )
+    this->conflate_flush();
+}
+
 void
 EvNatsService::set_prefix( const char *pref,  size_t preflen ) noexcept
 {
   this->prefix_len = cpyb<MAX_PREFIX_LEN>( this->prefix, pref, preflen );
+  this->map_gen++;
 }
 
 void
@@ -1264,6 +2252,33 @@ EvNatsService::parse_connect( const char *buf,  size_t bufsz ) noexcept
           if ( iter->get_reference( mref ) == 0 && mref.ftype == MD_BOOLEAN )
             this->user.binary = ( mref.fptr[ 0 ] != 0 );
           break;
+        case NATS_JS_ENCODING: /* encoding:"json|rv|tibmsg|raw" */
+          if ( iter->get_reference( mref ) == 0 && mref.ftype == MD_STRING ) {
+            for ( uint8_t enc = 0; enc <= NATS_ENC_RAW; enc++ ) {
+              const char * s = nats_encoding_name( enc );
+              size_t       n = ::strlen( s );
+              if ( ( mref.fsize == n || ( mref.fsize == n + 1 &&
+                                          mref.fptr[ n ] == '\0' ) ) &&
+                   ::memcmp( mref.fptr, s, n ) == 0 ) {
+                this->user.encoding = enc;
+                this->user.binary   = ( enc == NATS_ENC_RAW );
+                break;
+              }
+            }
+          }
+          break;
+        case NATS_JS_DELTA: /* delta:false */
+          if ( iter->get_reference( mref ) == 0 && mref.ftype == MD_BOOLEAN )
+            this->user.delta = ( mref.fptr[ 0 ] != 0 );
+          break;
+        case NATS_JS_CONFLATE: /* conflate:false */
+          if ( iter->get_reference( mref ) == 0 && mref.ftype == MD_BOOLEAN )
+            this->user.conflate = ( mref.fptr[ 0 ] != 0 );
+          break;
+        case NATS_JS_SEQUENCE: /* sequence:false */
+          if ( iter->get_reference( mref ) == 0 && mref.ftype == MD_BOOLEAN )
+            this->user.sequence = ( mref.fptr[ 0 ] != 0 );
+          break;
         case NATS_JS_PROTOCOL: /* proto:1 */
           if ( iter->get_reference( mref ) == 0 )
             cvt_number( mref, this->user.protocol );
@@ -1309,6 +2324,8 @@ EvNatsService::parse_connect( const char *buf,  size_t bufsz ) noexcept
     }
   } while ( iter->next() == 0 );
 do_notify:;
+  if ( this->user.binary )
+    this->user.encoding = NATS_ENC_RAW;
   if ( this->user.user == NULL || ::strlen( this->user.user ) == 0 )
     this->user.save_string( this->user.user, "nobody", 6 );
   if ( this->user.stamp == 0 ) {
@@ -1458,6 +2475,91 @@ NatsSubMap::print( void ) noexcept
   }
 }
 
+/* count the chain of entries with the same hash, only the first in the chain
+ * is counted, the rest are skipped */
+template <class Tab, class Entry>
+static void
+tab_chain_stats( Tab &tab,  Entry *e,  NatsTabStats &st ) noexcept
+{
+  RouteLoc loc;
+  uint32_t n = 1;
+  if ( tab.find_by_hash( e->hash, loc ) != e )
+    return;
+  while ( tab.find_next_by_hash( e->hash, loc ) != NULL )
+    n++;
+  st.add_chain( n );
+}
+
+template <class Tab, class Entry>
+static void
+tab_entry_stats( Tab &tab,  Entry *e,  NatsTabStats &st ) noexcept
+{
+  st.count++;
+  st.bytes += sizeof( Entry ) + e->len - 2;
+  tab_chain_stats<Tab, Entry>( tab, e, st );
+}
+
+static void
+sub_tab_stats( NatsSubTab &tab,  NatsTabStats &st,  NatsMapStats &ms ) noexcept
+{
+  RouteLoc       loc;
+  NatsSubRoute * r;
+  for ( r = tab.first( loc ); r; r = tab.next( loc ) ) {
+    tab_entry_stats<NatsSubTab, NatsSubRoute>( tab, r, st );
+    ms.sid_hist[ NatsTabStats::hist_bucket( r->refcnt ) ]++;
+  }
+}
+
+static void
+pat_tab_stats( NatsPatternTab &tab,  NatsTabStats &st,
+               NatsMapStats &ms ) noexcept
+{
+  RouteLoc           loc;
+  NatsPatternRoute * p;
+  NatsWildMatch    * m;
+  for ( p = tab.first( loc ); p; p = tab.next( loc ) ) {
+    tab_entry_stats<NatsPatternTab, NatsPatternRoute>( tab, p, st );
+    for ( m = p->list.hd; m != NULL; m = m->next ) {
+      st.bytes += sizeof( NatsWildMatch ) + m->len - 2;
+      ms.sid_hist[ NatsTabStats::hist_bucket( m->refcnt ) ]++;
+      ms.wild_count++;
+    }
+    ms.per_prefix_hist[ NatsTabStats::hist_bucket( p->count ) ]++;
+    if ( p->count > ms.max_per_prefix ) {
+      ms.max_per_prefix = p->count;
+      ms.max_prefix     = p->value;
+      ms.max_prefix_len = p->len;
+    }
+  }
+}
+
+void
+NatsSubMap::stats( NatsMapStats &st ) noexcept
+{
+  RouteLoc   loc;
+  SidEntry * s;
+
+  st.zero();
+  sub_tab_stats( this->sub_tab, st.sub, st );
+  sub_tab_stats( this->qsub_tab, st.qsub, st );
+  pat_tab_stats( this->pat_tab, st.pat, st );
+  pat_tab_stats( this->qpat_tab, st.qpat, st );
+  for ( s = this->sid_tab.first( loc ); s; s = this->sid_tab.next( loc ) )
+    tab_entry_stats< kv::RouteVec<SidEntry>, SidEntry >( this->sid_tab, s,
+                                                         st.sid );
+}
+
+void
+NatsSubMap::counts( NatsMapStats &st ) noexcept
+{
+  st.zero();
+  st.sub.count  = (uint32_t) this->sub_tab.pop_count();
+  st.qsub.count = (uint32_t) this->qsub_tab.pop_count();
+  st.pat.count  = (uint32_t) this->pat_tab.pop_count();
+  st.qpat.count = (uint32_t) this->qpat_tab.pop_count();
+  st.sid.count  = (uint32_t) this->sid_tab.pop_count();
+}
+
 const char *
 rai::natsmd::nats_status_str( NatsSubStatus status )
 {
@@ -24,6 +24,21 @@ int nats_client_pub_verbose,
     nats_client_info_verbose,
     nats_client_cmd_verbose,
     nats_client_init;
+/* an incomplete fragmented msg is dropped after NATS_CLIENT_FRAG_TIMEOUT
+ * seconds, and the oldest are dropped when the fragments pending are more
+ * than NATS_CLIENT_FRAG_MEM bytes */
+static uint32_t nats_client_frag_timeout = 30;
+static uint64_t nats_client_frag_mem     = 256 * 1024 * 1024;
+/* NATS_CLIENT_FRAG_STREAM=true forwards each fragment as it arrives with
+ * Nats-Frag-Offset and Nats-Frag-Size headers, instead of the whole msg;
+ * only fragments recvd as MSG are streamed, an HMSG fragment already has a
+ * header and is merged into the whole msg as without streaming; a
+ * subscriber which does not see headers, a transport without them or a
+ * client which did not CONNECT with "headers":true, gets the fragment
+ * bytes without the offset, so it must not subscribe to a subject which
+ * streams */
+static int      nats_client_frag_stream;
+static const uint64_t NATS_FRAG_EID      = 1; /* timer event id */
 
 extern "C" {
 EvConnection *
@@ -56,6 +71,14 @@ nats_client_static_init( void ) noexcept
   nats_client_sub_verbose  |= all_verbose;
   nats_client_info_verbose |= all_verbose;
   nats_client_cmd_verbose  |= all_verbose;
+  nats_client_frag_stream   = getenv_bool( "NATS_CLIENT_FRAG_STREAM" );
+  const char *val;
+  if ( (val = ::getenv( "NATS_CLIENT_FRAG_TIMEOUT" )) != NULL &&
+       ::atoi( val ) > 0 )
+    nats_client_frag_timeout = (uint32_t) ::atoi( val );
+  if ( (val = ::getenv( "NATS_CLIENT_FRAG_MEM" )) != NULL &&
+       ::strtoull( val, NULL, 0 ) > 0 )
+    nats_client_frag_mem = ::strtoull( val, NULL, 0 );
 }
 
 EvNatsClient::EvNatsClient( EvPoll &p,  RoutePublish &sr,
@@ -63,13 +86,18 @@ EvNatsClient::EvNatsClient( EvPoll &p,  RoutePublish &sr,
     : EvConnection( p, p.register_type( "natsclient" ), n ),
       RouteNotify( sr ), sub_route( sr ), cb( 0 ),
       next_sid( 1 ), protocol( 1 ), fwd_all_msgs( 0 ), fwd_all_subs( 1 ),
-      max_payload( 1024 * 1024 ), sid_ht( 0 ),
+      max_payload( 1024 * 1024 ), frag_ht( 0 ), frag_mem( 0 ),
+      frag_timer_id( 0 ), frag_completed( 0 ), frag_timeouts( 0 ),
+      frag_evicted( 0 ), frag_dropped( 0 ), frag_zero_ref( 0 ),
+      frag_timer_on( false ), frag_stream( false ),
+      sid_ht( 0 ),
       prefix_len( 0 ), session_len( 0 ),
       name( 0 ), lang( 0 ), version( 0 ), user( 0 ), pass( 0 ), auth_token( 0 ),
       param_buf( 0 )
 {
   if ( ! nats_client_init )
     nats_client_static_init();
+  this->frag_stream = ( nats_client_frag_stream != 0 );
 }
 
 EvNatsClient::EvNatsClient( EvPoll &p ) noexcept
@@ -77,13 +105,18 @@ EvNatsClient::EvNatsClient( EvPoll &p ) noexcept
       RouteNotify( p.sub_route ),
       sub_route( p.sub_route ), cb( 0 ),
       next_sid( 1 ), protocol( 1 ), fwd_all_msgs( 0 ), fwd_all_subs( 1 ),
-      max_payload( 1024 * 1024 ), sid_ht( 0 ),
+      max_payload( 1024 * 1024 ), frag_ht( 0 ), frag_mem( 0 ),
+      frag_timer_id( 0 ), frag_completed( 0 ), frag_timeouts( 0 ),
+      frag_evicted( 0 ), frag_dropped( 0 ), frag_zero_ref( 0 ),
+      frag_timer_on( false ), frag_stream( false ),
+      sid_ht( 0 ),
       prefix_len( 0 ), session_len( 0 ),
       name( 0 ), lang( 0 ), version( 0 ), user( 0 ), pass( 0 ), auth_token( 0 ),
       param_buf( 0 )
 {
   if ( ! nats_client_init )
     nats_client_static_init();
+  this->frag_stream = ( nats_client_frag_stream != 0 );
 }
 
 bool NatsClientCB::on_nats_msg( EvPublish & ) noexcept { return true; }
@@ -116,6 +149,9 @@ EvNatsClient::connect( kv::EvConnectParam &param ) noexcept
       parm2.pass = param.argv[ i + 1 ];
     else if ( ::strcmp( param.argv[ i ], "auth_token" ) == 0 )
       parm2.auth_token = param.argv[ i + 1 ];
+    else if ( ::strcmp( param.argv[ i ], "frag_stream" ) == 0 )
+      this->frag_stream = ( param.argv[ i + 1 ][ 0 ] == 't' ||
+                            param.argv[ i + 1 ][ 0 ] == '1' );
   }
   if ( this->nats_connect( parm2, param.n, NULL ) ) {
     for ( int i = 0; i + 1 < param.argc; i += 2 ) {
@@ -447,8 +483,27 @@ EvNatsClient::fwd_pub( NatsMsg &msg ) noexcept
        ! this->frags_pending.is_empty() ) {
     NatsTrailer trail( msg.msg_ptr, msg.msg_len );
     if ( trail.is_fragment( xsub.hash(), this->max_payload ) ) {
-      if ( (frag = this->merge_fragment( trail, msg.msg_ptr,
-                                         msg.msg_len )) != NULL ) {
+      /* HMSG fragments are merged, see NATS_CLIENT_FRAG_STREAM */
+      if ( this->frag_stream && msg.hdr_len == 0 ) {
+        if ( ! this->stream_fragment( trail, msg.msg_len ) )
+          return true; /* out of order, the msg is dropped */
+        /* the fragment with its offset in a header, the trailer removed */
+        size_t frag_size = msg.msg_len - sizeof( NatsTrailer );
+        CatPtr p( this->alloc_temp( NATS_HDR_STATUS_LEN +
+                                    sizeof( NATS_HDR_FRAG_OFF ) +
+                                    sizeof( NATS_HDR_FRAG_SIZE ) + 2 * 10 +
+                                    3 * 2 + frag_size ) );
+        p.s( NATS_HDR_STATUS )
+         .s( NATS_HDR_FRAG_OFF ).u( trail.off ).s( "\r\n" )
+         .s( NATS_HDR_FRAG_SIZE ).u( trail.msg_len ).s( "\r\n" )
+         .s( "\r\n" );
+        pub.hdr_len = (uint32_t) p.len();
+        p.b( msg.msg_ptr, frag_size );
+        pub.msg     = p.start;
+        pub.msg_len = p.len();
+      }
+      else if ( (frag = this->merge_fragment( trail, msg.msg_ptr,
+                                              msg.msg_len )) != NULL ) {
         pub.msg_len = frag->msg_len;
         pub.msg     = frag->msg_ptr();
       }
@@ -489,29 +544,10 @@ EvNatsClient::fwd_pub( NatsMsg &msg ) noexcept
 bool
 EvNatsClient::deduplicate_wildcard( NatsMsg &msg,  EvPublish &pub ) noexcept
 {
-  BitSet64 bi( this->sub_route.pat_mask() );
-  uint32_t i, hash,
-           max_sid = 0;
-  /* bitmask of prefix lengths, 0 -> 63 chars */
-  if ( bi.first( i ) ) {
-    /* if didn't hash prefixes */
-    do {
-      if ( i > msg.subject_len )
-        break;
-      hash = this->sub_route.prefix_seed( i );
-      if ( i > 0 )
-        hash = kv_crc_c( msg.subject, i, hash );
-      NatsPrefix *pref = this->pat_tab.find( hash, msg.subject,
-                                             (size_t) i );
-      if ( pref != NULL ) {
-        if ( msg.sid[ 0 ] != '-' ) /* not a wildcard sid */
-          return true; /* matches a wildcard, toss the subject publish */
-        if ( pref->sid > max_sid ) /* find the maximum sid */
-          max_sid = pref->sid;
-      }
-      /* track the prefix hashes, it is used by poll.forward_msg() */
-    } while ( bi.next( i ) );
-  }
+  /* one walk over the subject finds all the prefixes subscribed */
+  uint32_t max_sid = this->pat_trie.max_sid( msg.subject, msg.subject_len );
+  if ( max_sid != 0 && msg.sid[ 0 ] != '-' ) /* not a wildcard sid */
+    return true; /* matches a wildcard, toss the subject publish */
   /* if no wildcard matches or the maximum sid matches, forward */
   if ( max_sid == 0 || (uint64_t) max_sid ==
                        string_to_uint64( &msg.sid[ 1 ], msg.sid_len - 1 ) ) {
@@ -522,25 +558,160 @@ EvNatsClient::deduplicate_wildcard( NatsMsg &msg,  EvPublish &pub ) noexcept
   /* toss the publish, only forward the maximum sid */
   return true;
 }
-/* if message is a fragment, find and merge into other fragments */
-NatsFragment *
-EvNatsClient::merge_fragment( NatsTrailer &trail,  const void *msg,
-                              size_t msg_len ) noexcept
+
+bool
+NatsPrefixTrie::reserve( uint32_t cnt ) noexcept
+{
+  if ( this->node_size - this->node_cnt >= cnt )
+    return true;
+  uint32_t sz = ( this->node_size == 0 ? 64 : this->node_size * 2 );
+  while ( sz - this->node_cnt < cnt )
+    sz *= 2;
+  Node * p = (Node *) ::realloc( this->node, sizeof( Node ) * sz );
+  if ( p == NULL )
+    return false;
+  this->node      = p;
+  this->node_size = sz;
+  return true;
+}
+
+uint32_t
+NatsPrefixTrie::new_node( char c ) noexcept
+{
+  uint32_t n = this->free_list;
+  if ( n != 0 )
+    this->free_list = this->node[ n ].sibling;
+  else {
+    if ( ! this->reserve( 1 ) )
+      return 0;
+    n = this->node_cnt++;
+  }
+  this->node[ n ].child   = 0;
+  this->node[ n ].sibling = 0;
+  this->node[ n ].sid     = 0;
+  this->node[ n ].cnt     = 0;
+  this->node[ n ].c       = c;
+  return n;
+}
+
+bool
+NatsPrefixTrie::add( const char *pre,  size_t len,  uint32_t sid ) noexcept
+{
+  uint32_t n = 0, c = 0, head = 0, tail = 0;
+  size_t   i = 0;
+  /* follow the path which exists, the rest is new */
+  if ( this->node_cnt != 0 ) {
+    for ( ; i < len; i++, n = c )
+      if ( (c = this->find_child( n, pre[ i ] )) == 0 )
+        break;
+  }
+  /* allocate before linking, a failure leaves the trie unchanged */
+  if ( ! this->reserve( (uint32_t) ( len - i ) +
+                        ( this->node_cnt == 0 ? 1 : 0 ) ) )
+    return false;
+  if ( this->node_cnt == 0 ) /* the root is node 0 */
+    this->new_node( 0 );
+  for ( ; i < len; i++ ) {
+    c = this->new_node( pre[ i ] );
+    if ( head == 0 )
+      head = c;
+    else
+      this->node[ tail ].child = c;
+    tail = c;
+  }
+  if ( head != 0 ) {
+    this->node[ head ].sibling = this->node[ n ].child;
+    this->node[ n ].child      = head;
+    n = tail;
+  }
+  this->node[ n ].sid = sid;
+  n = 0;
+  this->node[ 0 ].cnt++;
+  for ( i = 0; i < len; i++ ) {
+    n = this->find_child( n, pre[ i ] );
+    this->node[ n ].cnt++;
+  }
+  return true;
+}
+
+void
+NatsPrefixTrie::remove( const char *pre,  size_t len ) noexcept
 {
-  NatsFragment *p;
-  /* all frags pending are in a list */
-  for ( p = this->frags_pending.hd; p != NULL; p = p->next ) {
-    if ( p->src_id   == trail.src_id &&   /* the source matches */
-         p->src_time == trail.src_time && /* the time the message created */
-         p->hash     == trail.hash &&     /* the subject hash */
-         p->msg_len  == trail.msg_len )   /* the total length of the message */
+  uint32_t n = 0, parent, c;
+  size_t   i;
+  if ( this->node_cnt == 0 )
+    return;
+  /* check that it is here before changing counts */
+  for ( i = 0; i < len; i++ )
+    if ( (n = this->find_child( n, pre[ i ] )) == 0 )
+      return;
+  if ( this->node[ n ].sid == 0 )
+    return;
+  this->node[ n ].sid = 0;
+  this->node[ 0 ].cnt--;
+  for ( i = 0, parent = 0; i < len; i++, parent = c ) {
+    c = this->find_child( parent, pre[ i ] );
+    if ( --this->node[ c ].cnt == 0 ) {
+      /* unlink the rest of the path, c is the only prefix through it */
+      uint32_t *pp = &this->node[ parent ].child;
+      while ( *pp != c )
+        pp = &this->node[ *pp ].sibling;
+      *pp = this->node[ c ].sibling;
+      while ( c != 0 ) {
+        uint32_t next = this->node[ c ].child;
+        this->node[ c ].sibling = this->free_list;
+        this->free_list = c;
+        c = next;
+      }
+      return;
+    }
+  }
+}
+
+uint32_t
+NatsPrefixTrie::max_sid( const char *sub,  size_t len ) const noexcept
+{
+  if ( this->node_cnt == 0 )
+    return 0;
+  uint32_t n   = 0,
+           max = this->node[ 0 ].sid;
+  for ( size_t i = 0; i < len; i++ ) {
+    if ( (n = this->find_child( n, sub[ i ] )) == 0 )
       break;
+    if ( this->node[ n ].sid > max )
+      max = this->node[ n ].sid;
   }
+  return max;
+}
+
+void
+NatsPrefixTrie::release( void ) noexcept
+{
+  if ( this->node != NULL )
+    ::free( this->node );
+  this->node      = NULL;
+  this->node_cnt  = 0;
+  this->node_size = 0;
+  this->free_list = 0;
+}
+
+/* find the msg of a fragment by its trailer, if not found it must be the
+ * first fragment, start a msg with data_size bytes for the fragments */
+NatsFragment *
+EvNatsClient::find_fragment( NatsTrailer &trail,  size_t data_size ) noexcept
+{
+  FragKey        key( trail );
+  NatsFragment * p = NULL;
+  size_t         pos;
+  /* frags pending are indexed by the source, time, subject and size */
+  if ( this->frag_ht == NULL )
+    this->frag_ht = FragHashTab::resize( NULL );
   /* if no frag matches, must be the first fragment */
-  if ( p == NULL ) {
+  if ( ! this->frag_ht->find( key, pos, p ) ) {
     /* must start at 0 */
     if ( trail.off != 0 ) {
       fprintf( stderr, "fragment ignored, not starting at the head\n" );
+      this->frag_dropped++;
       return NULL;
     }
     /* must be larger than max_payload */
@@ -549,35 +720,155 @@ EvNatsClient::merge_fragment( NatsTrailer &trail,  const void *msg,
                trail.msg_len );
       return NULL;
     }
-    /* allocate space for entire message */
-    void *m = ::malloc( trail.msg_len + sizeof( NatsFragment ) );
+    size_t size = data_size + sizeof( NatsFragment );
+    if ( size > nats_client_frag_mem ) {
+      fprintf( stderr, "fragment ignored, msg_len %u is more than the "
+               "fragment memory limit\n", trail.msg_len );
+      this->frag_dropped++;
+      return NULL;
+    }
+    /* make room by dropping the oldest */
+    while ( this->frag_mem + size > nats_client_frag_mem ) {
+      NatsFragment * old = this->frags_pending.hd;
+      fprintf( stderr, "fragment evicted, %u of %u bytes recvd\n",
+               old->off, old->msg_len );
+      this->pop_fragment( old );
+      delete old;
+      this->frag_evicted++;
+    }
+    /* allocate space for entire message, or none when streaming */
+    void *m = ::malloc( size );
     if ( m == NULL ) {
       fprintf( stderr, "can't allocated fragment size %u\n", trail.msg_len );
+      this->frag_dropped++;
+      return NULL;
     }
-    /* push onto frag list */
+    /* push onto frag list, index it, and time it out if not completed */
     p = new ( m ) NatsFragment( trail.src_id, trail.src_time, trail.hash,
-                                trail.msg_len );
-    this->frags_pending.push_hd( p );
+                                trail.msg_len, this->poll.current_coarse_ns(),
+                                (uint32_t) data_size );
+    this->frags_pending.push_tl( p );
+    this->frag_ht->set( key, pos, p );
+    if ( this->frag_ht->need_resize() )
+      this->frag_ht = FragHashTab::resize( this->frag_ht );
+    this->frag_mem += size;
+    if ( ! this->frag_timer_on )
+      this->frag_timer_on =
+        this->poll.timer.add_timer_seconds( this->fd, 1, this->frag_timer_id,
+                                            NATS_FRAG_EID );
   }
+  return p;
+}
+
+/* if message is a fragment, find and merge into other fragments */
+NatsFragment *
+EvNatsClient::merge_fragment( NatsTrailer &trail,  const void *msg,
+                              size_t msg_len ) noexcept
+{
+  NatsFragment * p = this->find_fragment( trail, trail.msg_len );
+  if ( p == NULL )
+    return NULL;
   /* frags are published in offset order */
-  if ( trail.off != p->off ) {
+  if ( trail.off != p->off || p->buf_size != p->msg_len ) {
     fprintf( stderr, "fragment offset %u:%u missing data\n", trail.off, p->off );
-    this->frags_pending.pop( p );
+    this->pop_fragment( p );
     delete p;
+    this->frag_dropped++;
     return NULL;
   }
   /* merge fragment */
   uint8_t * frag_msg  = (uint8_t *) p->msg_ptr();
   size_t    frag_size = msg_len - sizeof( NatsTrailer );
+  if ( frag_size > (size_t) ( p->msg_len - p->off ) ) {
+    fprintf( stderr, "fragment offset %u size %u past msg_len %u\n",
+             trail.off, (uint32_t) frag_size, p->msg_len );
+    this->pop_fragment( p );
+    delete p;
+    this->frag_dropped++;
+    return NULL;
+  }
   ::memcpy( &frag_msg[ trail.off ], msg, frag_size );
   p->off += (uint32_t) frag_size;
   /* if all fragments are recvd */
   if ( p->off == p->msg_len ) {
-    this->frags_pending.pop( p );
+    this->pop_fragment( p );
+    this->frag_completed++;
     return p;
   }
   return NULL;
 }
+
+/* a streamed fragment is forwarded as it arrives, only the offset of the
+ * msg is tracked so that a missing fragment drops the rest of it */
+bool
+EvNatsClient::stream_fragment( NatsTrailer &trail,  size_t msg_len ) noexcept
+{
+  NatsFragment * p = this->find_fragment( trail, 0 );
+  if ( p == NULL )
+    return false;
+  size_t frag_size = msg_len - sizeof( NatsTrailer );
+  if ( trail.off != p->off ||
+       frag_size > (size_t) ( p->msg_len - p->off ) ) {
+    fprintf( stderr, "fragment offset %u:%u missing data\n",
+             trail.off, p->off );
+    this->pop_fragment( p );
+    delete p;
+    this->frag_dropped++;
+    return false;
+  }
+  p->off += (uint32_t) frag_size;
+  if ( p->off == p->msg_len ) {
+    this->pop_fragment( p );
+    delete p;
+    this->frag_completed++;
+  }
+  return true;
+}
+
+void
+EvNatsClient::pop_fragment( NatsFragment *p ) noexcept
+{
+  FragKey        key( *p );
+  NatsFragment * q;
+  size_t         pos;
+  if ( this->frag_ht->find( key, pos, q ) ) {
+    this->frag_ht->remove( pos );
+    if ( this->frag_ht->need_resize() )
+      this->frag_ht = FragHashTab::resize( this->frag_ht );
+  }
+  this->frags_pending.pop( p );
+  this->frag_mem -= p->buf_size + sizeof( NatsFragment );
+}
+
+/* frags_pending is in arrival order, stop at the first one not timed out */
+bool
+EvNatsClient::expire_fragments( uint64_t now ) noexcept
+{
+  uint64_t timeout_ns = (uint64_t) nats_client_frag_timeout * 1000000000;
+  NatsFragment * p;
+  while ( (p = this->frags_pending.hd) != NULL &&
+          p->start_ns + timeout_ns <= now ) {
+    fprintf( stderr, "fragment timeout, %u of %u bytes recvd\n",
+             p->off, p->msg_len );
+    this->pop_fragment( p );
+    delete p;
+    this->frag_timeouts++;
+  }
+  return ! this->frags_pending.is_empty();
+}
+
+bool
+EvNatsClient::timer_expire( uint64_t tid,  uint64_t eid ) noexcept
+{
+  if ( eid != NATS_FRAG_EID || tid != this->frag_timer_id ||
+       ! this->frag_timer_on )
+    return false;
+  /* keep the timer while frags are pending */
+  if ( this->expire_fragments( this->poll.current_coarse_ns() ) )
+    return true;
+  this->frag_timer_on = false;
+  return false;
+}
 void
 EvNatsClient::process_close( void ) noexcept
 {
@@ -597,6 +888,14 @@ EvNatsClient::release_fragments( void ) noexcept
     }
     this->frags_pending.init();
   }
+  if ( this->frag_ht != NULL ) {
+    delete this->frag_ht;
+    this->frag_ht = NULL;
+  }
+  this->frag_mem = 0;
+  /* a timer still running is for the old connection */
+  this->frag_timer_id++;
+  this->frag_timer_on = false;
 }
 /* used to create a message */
 static inline char *
@@ -700,7 +999,8 @@ EvNatsClient::publish2( EvPublish &pub,  const char *sub,  size_t sublen,
                        pub.msg_len );
     size_t      frag_size = this->max_payload - sizeof( NatsTrailer ),
                 msg_len   = this->max_payload;
-    bool        is_last   = false;
+    bool        is_last   = false,
+                use_iov   = true; /* frags are iovecs, once one is a ref */
 
     msg_len_digits = uint64_digits( msg_len );
     for ( trail.off = 0; trail.off < pub.msg_len;
@@ -721,7 +1021,24 @@ EvNatsClient::publish2( EvPublish &pub,  const char *sub,  size_t sublen,
              msg_len_digits + 2 + /* <size> \r\n */
              msg_len + 2;         /* <blob> \r\n */
 
-      p = concat_hdr( this->alloc( len ), "PUB ", 4 );
+      /* reference the fragment of the payload instead of copying it, a ref
+       * is taken for each, since each is released when it is written */
+      const uint8_t * frag_ptr = &((const uint8_t *) pub.msg)[ trail.off ];
+      uint32_t        idx_ref  = 0;
+      if ( use_iov ) {
+        idx_ref = this->poll.zero_copy_ref( pub.src_route.fd, frag_ptr,
+                                            frag_size );
+        if ( idx_ref == 0 && trail.off == 0 )
+          use_iov = false; /* no refs, copy into the send buffer */
+      }
+      char * hdr;
+      if ( idx_ref != 0 ) /* header and trailer, the blob is a ref */
+        hdr = this->alloc_temp( len - frag_size );
+      else if ( use_iov ) /* after a ref, keep the iovecs in order */
+        hdr = this->alloc_temp( len );
+      else
+        hdr = this->alloc( len );
+      p = concat_hdr( hdr, "PUB ", 4 );
       p = encode_sub( p, sub, sublen );
       *p++ = ' ';
       if ( is_last && replen > 0 ) {
@@ -731,13 +1048,27 @@ EvNatsClient::publish2( EvPublish &pub,  const char *sub,  size_t sublen,
       uint64_to_string( msg_len, p, msg_len_digits );
       p = &p[ msg_len_digits ];
       *p++ = '\r'; *p++ = '\n';
-      ::memcpy( p, &((uint8_t *) pub.msg)[ trail.off ], frag_size );
+      if ( idx_ref != 0 ) {
+        char * trailer = p;
+        ::memcpy( p, &trail, sizeof( NatsTrailer ) );
+        p += sizeof( NatsTrailer );
+        *p++ = '\r'; *p++ = '\n';
+        this->append_ref_iov( hdr, trailer - hdr, frag_ptr, frag_size,
+                              idx_ref, 0 );
+        this->append_iov( trailer, sizeof( NatsTrailer ) + 2 );
+        this->frag_zero_ref++;
+        continue;
+      }
+      ::memcpy( p, frag_ptr, frag_size );
       p += frag_size;
       ::memcpy( p, &trail, sizeof( NatsTrailer ) );
       p += sizeof( NatsTrailer );
       *p++ = '\r'; *p++ = '\n';
 
-      this->sz += len;
+      if ( use_iov )
+        this->append_iov( hdr, len );
+      else
+        this->sz += len;
     }
   }
   return this->idle_push_write();
@@ -1011,6 +1342,9 @@ EvNatsClient::do_psub( uint32_t h,  const char *prefix,
       return;
     }
     pat->sid = sid;
+    if ( ! this->pat_trie.add( prefix, prefix_len, sid ) )
+      fprintf( stderr, "pattern trie error: %.*s\n", (int) prefix_len,
+               prefix );
   }
   else {
     pat = this->pat_tab.find( h, prefix, (size_t) prefix_len );
@@ -1101,6 +1435,7 @@ EvNatsClient::do_punsub( uint32_t h,  const char *prefix,
     uint8_t w = ( prefix_len == 0 ? 0 : prefix[ 0 ] );
     this->clear_wildcard_match( w );
     this->pat_tab.remove( h, prefix, (size_t) prefix_len );
+    this->pat_trie.remove( prefix, prefix_len );
 
     size_t   len        = 6 +                 /* UNSUB */
                           1 + sid_digits + 2; /* -<sid>\r\n */
@@ -1271,6 +1606,7 @@ EvNatsClient::release( void ) noexcept
     this->sid_ht = NULL;
   }
   this->pat_tab.release();
+  this->pat_trie.release();
   if ( this->param_buf != NULL ) {
     ::free( this->param_buf );
     this->param_buf = NULL; 
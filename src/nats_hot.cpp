@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <natsmd/nats_hot.h>
+#include <raikv/util.h>
+
+using namespace rai;
+using namespace natsmd;
+
+NatsHotTrack *
+NatsHotTrack::create( uint32_t sample ) noexcept
+{
+  NatsHotTrack * t = (NatsHotTrack *) ::malloc( sizeof( NatsHotTrack ) );
+  if ( t != NULL ) {
+    t->sample = ( sample == 0 ? 1 : sample );
+    t->zero();
+  }
+  return t;
+}
+
+void
+NatsHotTrack::zero( void ) noexcept
+{
+  uint32_t sample = this->sample;
+  ::memset( (void *) this, 0, sizeof( *this ) );
+  this->sample   = sample;
+  this->start_ns = kv_current_realtime_ns();
+}
+
+void
+NatsHotHeap::update( uint32_t h,  const char *sub,  size_t len,
+                     uint64_t est ) noexcept
+{
+  uint32_t i;
+  if ( len > NatsHotEntry::SUBJ_LEN )
+    len = NatsHotEntry::SUBJ_LEN;
+  for ( i = 0; i < this->n; i++ ) {
+    NatsHotEntry & x = this->e[ i ];
+    if ( x.hash == h && x.len == len && ::memcmp( x.subj, sub, len ) == 0 ) {
+      x.count = est;
+      this->sift_down( i ); /* count increased */
+      return;
+    }
+  }
+  if ( this->n < TOP_N )
+    i = this->n++;
+  else if ( est > this->e[ 0 ].count )
+    i = 0;
+  else
+    return;
+  NatsHotEntry & x = this->e[ i ];
+  x.count = est;
+  x.hash  = h;
+  x.len   = (uint16_t) len;
+  ::memcpy( x.subj, sub, len );
+  if ( i == 0 )
+    this->sift_down( 0 );
+  else
+    this->sift_up( i );
+}
+
+void
+NatsHotHeap::sift_down( uint32_t i ) noexcept
+{
+  for (;;) {
+    uint32_t l = i * 2 + 1, r = l + 1, m = i;
+    if ( l < this->n && this->e[ l ].count < this->e[ m ].count )
+      m = l;
+    if ( r < this->n && this->e[ r ].count < this->e[ m ].count )
+      m = r;
+    if ( m == i )
+      return;
+    NatsHotEntry tmp = this->e[ i ];
+    this->e[ i ] = this->e[ m ];
+    this->e[ m ] = tmp;
+    i = m;
+  }
+}
+
+void
+NatsHotHeap::sift_up( uint32_t i ) noexcept
+{
+  while ( i > 0 ) {
+    uint32_t p = ( i - 1 ) / 2;
+    if ( this->e[ p ].count <= this->e[ i ].count )
+      return;
+    NatsHotEntry tmp = this->e[ i ];
+    this->e[ i ] = this->e[ p ];
+    this->e[ p ] = tmp;
+    i = p;
+  }
+}
+
+static int
+cmp_hot( const void *x,  const void *y ) noexcept
+{
+  const NatsHotEntry * a = (const NatsHotEntry *) x,
+                     * b = (const NatsHotEntry *) y;
+  return a->count > b->count ? -1 : a->count < b->count ? 1 : 0;
+}
+
+uint32_t
+NatsHotHeap::sorted( NatsHotEntry *out ) const noexcept
+{
+  ::memcpy( out, this->e, sizeof( this->e[ 0 ] ) * this->n );
+  if ( this->n > 1 )
+    ::qsort( out, this->n, sizeof( out[ 0 ] ), cmp_hot );
+  return this->n;
+}
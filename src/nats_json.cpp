@@ -0,0 +1,321 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#if defined( __SSE2__ ) && defined( __GNUC__ )
+#include <emmintrin.h>
+#define NATS_JSON_SSE2
+#endif
+#include <natsmd/nats_json.h>
+#include <raimd/json_msg.h>
+
+using namespace rai;
+using namespace natsmd;
+using namespace md;
+
+size_t
+rai::natsmd::nats_json_escape_scan( const char *s,  size_t len ) noexcept
+{
+  size_t i = 0;
+#ifdef NATS_JSON_SSE2
+  const __m128i quote  = _mm_set1_epi8( '"' ),
+                bslash = _mm_set1_epi8( '\\' ),
+                ctrl   = _mm_set1_epi8( 0x1f );
+  for ( ; i + 16 <= len; i += 16 ) {
+    __m128i v = _mm_loadu_si128( (const __m128i *) &s[ i ] ),
+            m = _mm_or_si128(
+                  _mm_or_si128( _mm_cmpeq_epi8( v, quote ),
+                                _mm_cmpeq_epi8( v, bslash ) ),
+                  /* v <= 0x1f unsigned */
+                  _mm_cmpeq_epi8( _mm_min_epu8( v, ctrl ), v ) );
+    int mask = _mm_movemask_epi8( m );
+    if ( mask != 0 )
+      return i + (size_t) __builtin_ctz( (unsigned int) mask );
+  }
+#endif
+  for ( ; i < len; i++ ) {
+    uint8_t c = (uint8_t) s[ i ];
+    if ( c < 0x20 || c == '"' || c == '\\' )
+      return i;
+  }
+  return len;
+}
+
+static const char digit_pairs[] =
+  "00010203040506070809101112131415161718192021222324252627282930313233343536"
+  "37383940414243444546474849505152535455565758596061626364656667686970717273"
+  "7475767778798081828384858687888990919293949596979899";
+
+size_t
+rai::natsmd::nats_json_uint_str( uint64_t v,  char *out ) noexcept
+{
+  char   tmp[ 20 ],
+       * p = &tmp[ 20 ];
+  while ( v >= 100 ) {
+    uint32_t r = (uint32_t) ( v % 100 );
+    v /= 100;
+    p -= 2;
+    ::memcpy( p, &digit_pairs[ r * 2 ], 2 );
+  }
+  if ( v >= 10 ) {
+    p -= 2;
+    ::memcpy( p, &digit_pairs[ v * 2 ], 2 );
+  }
+  else {
+    *--p = (char) ( '0' + v );
+  }
+  size_t n = &tmp[ 20 ] - p;
+  ::memcpy( out, p, n );
+  return n;
+}
+
+void
+NatsJsonWriter::string( const char *s,  size_t len ) noexcept
+{
+  static const char hex[] = "0123456789abcdef";
+  if ( ! this->has_space( len + 2 ) )
+    return;
+  this->buf[ this->off++ ] = '"';
+  for (;;) {
+    size_t n = nats_json_escape_scan( s, len );
+    if ( ! this->has_space( n + 1 ) )
+      return;
+    ::memcpy( &this->buf[ this->off ], s, n );
+    this->off += n;
+    if ( n == len )
+      break;
+    uint8_t c = (uint8_t) s[ n ];
+    s    = &s[ n + 1 ];
+    len -= n + 1;
+    if ( ! this->has_space( 6 + len + 1 ) )
+      return;
+    char * p = &this->buf[ this->off ];
+    p[ 0 ] = '\\';
+    switch ( c ) {
+      case '"':  p[ 1 ] = '"';  this->off += 2; break;
+      case '\\': p[ 1 ] = '\\'; this->off += 2; break;
+      case '\n': p[ 1 ] = 'n';  this->off += 2; break;
+      case '\r': p[ 1 ] = 'r';  this->off += 2; break;
+      case '\t': p[ 1 ] = 't';  this->off += 2; break;
+      case '\b': p[ 1 ] = 'b';  this->off += 2; break;
+      case '\f': p[ 1 ] = 'f';  this->off += 2; break;
+      default:
+        p[ 1 ] = 'u'; p[ 2 ] = '0'; p[ 3 ] = '0';
+        p[ 4 ] = hex[ c >> 4 ]; p[ 5 ] = hex[ c & 15 ];
+        this->off += 6;
+        break;
+    }
+  }
+  this->buf[ this->off++ ] = '"';
+}
+
+void
+NatsJsonWriter::uint64( uint64_t v ) noexcept
+{
+  if ( this->has_space( 20 ) )
+    this->off += nats_json_uint_str( v, &this->buf[ this->off ] );
+}
+
+void
+NatsJsonWriter::int64( int64_t v ) noexcept
+{
+  if ( v >= 0 ) {
+    this->uint64( (uint64_t) v );
+    return;
+  }
+  if ( this->has_space( 21 ) ) {
+    this->buf[ this->off++ ] = '-';
+    this->off += nats_json_uint_str( ~(uint64_t) v + 1,
+                                     &this->buf[ this->off ] );
+  }
+}
+
+static const uint64_t u10[] = {
+  1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+  100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL,
+  1000000000000ULL, 10000000000000ULL, 100000000000000ULL,
+  1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL,
+  1000000000000000000ULL, 10000000000000000000ULL };
+
+void
+NatsJsonWriter::fixed( uint64_t u,  uint32_t k,  bool neg ) noexcept
+{
+  if ( ! this->has_space( 1 + 20 + 1 + k ) )
+    return;
+  char * p = &this->buf[ this->off ];
+  if ( neg )
+    *p++ = '-';
+  p = &p[ nats_json_uint_str( u / u10[ k ], p ) ];
+  if ( k > 0 ) {
+    char   frac[ 20 ];
+    size_t n = nats_json_uint_str( u % u10[ k ], frac );
+    *p++ = '.';
+    for ( size_t z = n; z < (size_t) k; z++ ) /* leading zeros */
+      *p++ = '0';
+    ::memcpy( p, frac, n );
+    p = &p[ n ];
+  }
+  this->off = p - this->buf;
+}
+
+/* prices are usually a few decimals, find the fewest which round trip,
+ * otherwise print 17 digits */
+void
+NatsJsonWriter::real( double v ) noexcept
+{
+  static const double   p10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7,
+                                  1e8, 1e9 };
+  if ( ! this->has_space( 32 ) )
+    return;
+  if ( v != v || v - v != 0 ) { /* nan or inf */
+    ::memcpy( &this->buf[ this->off ], "null", 4 );
+    this->off += 4;
+    return;
+  }
+  double a = ( v < 0 ? -v : v );
+  for ( int k = 0; k < 10; k++ ) {
+    double x = a * p10[ k ];
+    if ( x >= 9007199254740992.0 ) /* 2^53 */
+      break;
+    double r = ::floor( x + 0.5 );
+    if ( r / p10[ k ] != a )
+      continue;
+    this->fixed( (uint64_t) r, (uint32_t) k, v < 0 );
+    return;
+  }
+  this->off += ::snprintf( &this->buf[ this->off ], 32, "%.17g", v );
+}
+
+/* an integer or a power of 10 decimal, which are the prices of a feed */
+bool
+NatsJsonWriter::decimal( MDReference &mref ) noexcept
+{
+  MDDecimal dec;
+  uint32_t  k;
+  if ( dec.get_decimal( mref ) != 0 )
+    return false;
+  switch ( dec.hint ) {
+    case MD_DEC_INTEGER:  k = 0; break;
+    case MD_DEC_LOGn10_1: k = 1; break;
+    case MD_DEC_LOGn10_2: k = 2; break;
+    case MD_DEC_LOGn10_3: k = 3; break;
+    case MD_DEC_LOGn10_4: k = 4; break;
+    case MD_DEC_LOGn10_5: k = 5; break;
+    case MD_DEC_LOGn10_6: k = 6; break;
+    case MD_DEC_LOGn10_7: k = 7; break;
+    case MD_DEC_LOGn10_8: k = 8; break;
+    case MD_DEC_LOGn10_9: k = 9; break;
+    default: return false; /* null, nan, inf, fractions, powers of 10 */
+  }
+  if ( dec.ival < 0 )
+    this->fixed( ~(uint64_t) dec.ival + 1, k, true );
+  else
+    this->fixed( (uint64_t) dec.ival, k, false );
+  return true;
+}
+
+/* types without a fast path, append with a JsonMsgWriter placed at the end
+ * of the output, then remove the object start that it writes first */
+bool
+NatsJsonWriter::other( const char *fname,  size_t fname_len,
+                       MDReference &mref ) noexcept
+{
+  char * start = &this->buf[ this->off ];
+  JsonMsgWriter jmsg( this->mem, start, this->buflen - this->off );
+  if ( jmsg.append_ref( fname, fname_len, mref ) != 0 ) {
+    this->err = -1;
+    return false;
+  }
+  size_t n = jmsg.off;
+  if ( n > 0 && start[ 0 ] == '{' ) {
+    ::memmove( start, &start[ 1 ], n - 1 );
+    n--;
+  }
+  this->off += n;
+  return true;
+}
+
+int
+NatsJsonWriter::append_ref( const char *fname,  size_t fname_len,
+                            MDReference &mref ) noexcept
+{
+  if ( fname_len > 0 && fname[ fname_len - 1 ] == '\0' )
+    fname_len--;
+  if ( this->fcnt > 0 ) {
+    if ( ! this->has_space( 1 ) )
+      return this->err;
+    this->buf[ this->off++ ] = ',';
+  }
+  switch ( mref.ftype ) {
+    case MD_STRING: {
+      size_t len = mref.fsize;
+      while ( len > 0 && mref.fptr[ len - 1 ] == '\0' )
+        len--;
+      this->string( fname, fname_len );
+      if ( this->has_space( 1 ) )
+        this->buf[ this->off++ ] = ':';
+      this->string( (const char *) mref.fptr, len );
+      break;
+    }
+    case MD_DECIMAL: {
+      size_t save = this->off;
+      this->string( fname, fname_len );
+      if ( this->has_space( 1 ) )
+        this->buf[ this->off++ ] = ':';
+      if ( this->err == 0 && ! this->decimal( mref ) ) {
+        this->off = save;
+        this->other( fname, fname_len, mref );
+      }
+      break;
+    }
+    case MD_INT:
+    case MD_UINT:
+    case MD_REAL:
+    case MD_BOOLEAN:
+      this->string( fname, fname_len );
+      if ( this->has_space( 1 ) )
+        this->buf[ this->off++ ] = ':';
+      if ( mref.ftype == MD_INT )
+        this->int64( get_int<int64_t>( mref ) );
+      else if ( mref.ftype == MD_UINT )
+        this->uint64( get_uint<uint64_t>( mref ) );
+      else if ( mref.ftype == MD_REAL )
+        this->real( get_float<double>( mref ) );
+      else if ( this->has_space( 5 ) ) {
+        bool b = ( mref.fsize > 0 && mref.fptr[ 0 ] != 0 );
+        ::memcpy( &this->buf[ this->off ], b ? "true" : "false", b ? 4 : 5 );
+        this->off += ( b ? 4 : 5 );
+      }
+      break;
+    default:
+      this->other( fname, fname_len, mref );
+      break;
+  }
+  if ( this->err != 0 )
+    return this->err;
+  this->fcnt++;
+  return 0;
+}
+
+int
+NatsJsonWriter::convert_msg( MDMsg &m ) noexcept
+{
+  MDFieldIter * iter;
+  MDName        name;
+  MDReference   mref;
+  int           status;
+
+  if ( (status = m.get_field_iter( iter )) != 0 )
+    return status;
+  if ( iter->first() != 0 )
+    return 0;
+  do {
+    if ( (status = iter->get_name( name )) != 0 ||
+         (status = iter->get_reference( mref )) != 0 )
+      return status;
+    if ( (status = this->append_ref( name.fname, name.fnamelen, mref )) != 0 )
+      return status;
+  } while ( iter->next() == 0 );
+  return 0;
+}
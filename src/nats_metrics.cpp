@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <natsmd/ev_nats.h>
+#include <natsmd/nats_sys.h>
+#include <natsmd/nats_metrics.h>
+#include <raikv/util.h>
+
+using namespace rai;
+using namespace natsmd;
+using namespace kv;
+
+/* # HELP natsmd_<name> <help>
+ * # TYPE natsmd_<name> <type>
+ * natsmd_<name> <val> */
+static void
+prom( NatsSysBuf &out,  const char *name,  const char *type,
+      const char *help,  uint64_t val ) noexcept
+{
+  out.s( "# HELP natsmd_" ).s( name ).c( ' ' ).s( help )
+     .s( "\n# TYPE natsmd_" ).s( name ).c( ' ' ).s( type )
+     .s( "\nnatsmd_" ).s( name ).c( ' ' ).u( val ).c( '\n' );
+}
+
+void
+rai::natsmd::nats_metrics_text( EvNatsListen &l,  NatsSysBuf &out ) noexcept
+{
+  static const char counter[] = "counter",
+                    gauge[]   = "gauge";
+  NatsListenStats & ls = l.stats;
+  NatsVarz          v;
+
+  v.gather( l );
+  prom( out, "in_msgs_total", counter, "Msgs published by clients",
+        v.msgs_recv );
+  prom( out, "out_msgs_total", counter, "Msgs delivered to clients",
+        v.msgs_sent );
+  prom( out, "in_bytes_total", counter, "Bytes read from clients",
+        v.bytes_recv );
+  prom( out, "out_bytes_total", counter, "Bytes written to clients",
+        v.bytes_sent );
+  prom( out, "connections", gauge, "Connections open", v.cnt );
+  prom( out, "connections_total", counter, "Connections accepted",
+        ls.accept_cnt );
+  prom( out, "closed_connections_total", counter, "Connections closed",
+        ls.close_cnt );
+  prom( out, "subscriptions", gauge, "Subscriptions of open connections",
+        v.subs );
+  prom( out, "pending_bytes", gauge, "Bytes queued to write", v.pending );
+  prom( out, "backpressure_connections", gauge,
+        "Connections backpressured now", v.bp_cnt );
+  prom( out, "backpressure_total", counter,
+        "Pubs which backpressured the publisher", v.backpressure );
+  prom( out, "slow_consumer_drops_total", counter,
+        "Msgs dropped by the slow consumer drop policy", v.slow_drops );
+  prom( out, "slow_consumer_closes_total", counter,
+        "Connections closed by the slow consumer close policy",
+        ls.slow_closes );
+  prom( out, "transform_conversions_total", counter,
+        "Msgs transformed to json", v.converts );
+  prom( out, "transform_cache_hits_total", counter,
+        "Msgs transformed by a previous connection", v.xf_hits );
+  prom( out, "transform_cache_misses_total", counter,
+        "Msgs unpacked and converted", v.xf_misses );
+  prom( out, "transform_buffer_grows_total", counter,
+        "Conversions retried with a larger buffer", v.xf_grows );
+  prom( out, "zero_copy_refs_total", counter,
+        "Msgs appended by reference instead of copied", v.zero_refs );
+  prom( out, "zero_copy_bytes_total", counter,
+        "Bytes appended by reference instead of copied", v.zero_ref_bytes );
+  prom( out, "read_calls_total", counter,
+        "Calls to read from clients", v.read_calls );
+  prom( out, "write_calls_total", counter,
+        "Calls to write to clients", v.write_calls );
+  prom( out, "flush_timers_total", counter,
+        "Writes started by the flush timer", v.flush_timers );
+  prom( out, "start_time_seconds", gauge, "Listener start time",
+        ls.start_ns / 1000000000 );
+}
+
+EvNatsMetricsListen::EvNatsMetricsListen( EvPoll &p,  EvNatsListen &l ) noexcept
+  : EvTcpListen( p, "nats_metrics_listen", "nats_metrics_sock" ), nats( l )
+{
+}
+
+int
+EvNatsMetricsListen::listen( const char *ip,  int port,  int opts ) noexcept
+{
+  return this->kv::EvTcpListen::listen2( ip, port, opts, "nats_metrics_listen",
+                                         this->nats.sub_route.route_id );
+}
+
+EvSocket *
+EvNatsMetricsListen::accept( void ) noexcept
+{
+  EvNatsMetricsService *c =
+    this->poll.get_free_list<EvNatsMetricsService, EvNatsMetricsListen &>(
+      this->accept_sock_type, *this );
+
+  if ( c == NULL )
+    return NULL;
+  if ( ! this->accept2( *c, "nats_metrics" ) )
+    return NULL;
+  return c;
+}
+
+/* wait for the end of the request headers, reply and close */
+void
+EvNatsMetricsService::process( void ) noexcept
+{
+  static const size_t MAX_REQUEST = 16 * 1024;
+  const char * req = &this->recv[ this->off ],
+             * end = &this->recv[ this->len ],
+             * p   = req;
+  bool         done = false;
+
+  while ( (p = (const char *) ::memchr( p, '\n', end - p )) != NULL ) {
+    p++;
+    if ( p < end && *p == '\r' )
+      p++;
+    if ( p < end && *p == '\n' ) {
+      done = true;
+      break;
+    }
+  }
+  this->pop( EV_PROCESS );
+  if ( ! done && (size_t) ( end - req ) < MAX_REQUEST )
+    return;
+
+  NatsSysBuf   body;
+  const char * status = "404 Not Found";
+  if ( done && end - req > 12 && ::memcmp( req, "GET /metrics", 12 ) == 0 &&
+       ( req[ 12 ] == ' ' || req[ 12 ] == '?' ) ) {
+    status = "200 OK";
+    nats_metrics_text( this->listen.nats, body );
+  }
+  else {
+    body.s( "not found, try /metrics\n" );
+  }
+  char hdr[ 256 ];
+  CatPtr h( hdr );
+  h.s( "HTTP/1.1 " ).s( status )
+   .s( "\r\nContent-Type: text/plain; version=0.0.4\r\n"
+       "Content-Length: " ).u( body.off )
+   .s( "\r\nConnection: close\r\n\r\n" );
+  this->append( hdr, h.len() );
+  this->append( body.buf, body.off );
+  this->off = this->len;
+  this->pop3( EV_READ, EV_READ_HI, EV_READ_LO );
+  this->push( EV_WRITE_HI );
+  this->push( EV_SHUTDOWN );
+}
+
+void
+EvNatsMetricsService::release( void ) noexcept
+{
+  this->EvConnection::release_buffers();
+}
@@ -0,0 +1,314 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <natsmd/ev_nats.h>
+#include <natsmd/nats_proj.h>
+#include <natsmd/nats_json.h>
+#include <raimd/rv_msg.h>
+#include <raimd/tib_msg.h>
+
+using namespace rai;
+using namespace natsmd;
+using namespace md;
+
+NatsFieldList *
+NatsFieldList::create( const char *list,  size_t len ) noexcept
+{
+  if ( len < 2 || list[ 0 ] != '{' || list[ len - 1 ] != '}' )
+    return NULL;
+  NatsFieldList * fl = (NatsFieldList *)
+    ::malloc( sizeof( NatsFieldList ) + len );
+  if ( fl == NULL )
+    return NULL;
+  const char * p   = &list[ 1 ],
+             * end = &list[ len - 1 ];
+  fl->cnt = 0;
+  fl->len = 0;
+  while ( p < end ) {
+    const char * comma = (const char *) ::memchr( p, ',', end - p );
+    if ( comma == NULL )
+      comma = end;
+    size_t n = comma - p;
+    if ( n > 0 ) {
+      if ( n > 255 || fl->cnt == MAX_FIELDS ) {
+        ::free( fl );
+        return NULL;
+      }
+      fl->names[ fl->len ] = (char) n;
+      ::memcpy( &fl->names[ fl->len + 1 ], p, n );
+      fl->len += (uint16_t) ( n + 1 );
+      fl->cnt++;
+    }
+    p = &comma[ 1 ];
+  }
+  if ( fl->cnt == 0 ) {
+    ::free( fl );
+    return NULL;
+  }
+  return fl;
+}
+
+bool
+NatsFieldList::match( const char *fname,  size_t fnamelen ) const noexcept
+{
+  if ( fnamelen > 0 && fname[ fnamelen - 1 ] == '\0' )
+    fnamelen--;
+  for ( const char * p = this->names; p < &this->names[ this->len ];
+        p = &p[ 1 + (uint8_t) p[ 0 ] ] ) {
+    if ( (uint8_t) p[ 0 ] == fnamelen &&
+         ::memcmp( &p[ 1 ], fname, fnamelen ) == 0 )
+      return true;
+  }
+  return false;
+}
+
+/* append the fields matched, stops when all are found */
+template <class Writer>
+static bool
+write_fields( Writer &w,  MDFieldIter &iter,  const NatsFieldList &fl,
+              bool strip_nul ) noexcept
+{
+  MDName      name;
+  MDReference mref;
+  uint32_t    n = 0;
+
+  if ( iter.first() != 0 )
+    return true;
+  do {
+    if ( iter.get_name( name ) != 0 ||
+         ! fl.match( name.fname, name.fnamelen ) ||
+         iter.get_reference( mref ) != 0 )
+      continue;
+    size_t len = name.fnamelen;
+    if ( strip_nul && len > 0 && name.fname[ len - 1 ] == '\0' )
+      len--;
+    if ( w.append_ref( name.fname, len, mref ) != 0 )
+      return false;
+    if ( ++n == fl.cnt )
+      break;
+  } while ( iter.next() == 0 );
+  return true;
+}
+
+bool
+rai::natsmd::nats_project( MDMsgMem &spc,  const void *msg,  size_t msg_len,
+                           uint32_t msg_enc,  uint8_t enc,
+                           const NatsFieldList &fl,  char *&out,
+                           size_t &out_len ) noexcept
+{
+  MDFieldIter * iter;
+  MDMsg * m = MDMsg::unpack( (void *) msg, 0, msg_len, 0, NULL, spc );
+  if ( m == NULL || m->get_field_iter( iter ) != 0 )
+    return false;
+  if ( enc >= NATS_ENC_CONVERT )
+    enc = ( msg_enc == RVMSG_TYPE_ID ? NATS_ENC_RV :
+            msg_enc == TIBMSG_TYPE_ID ? NATS_ENC_TIBMSG : NATS_ENC_JSON );
+  /* a few fields of a large msg, start small and double */
+  size_t limit   = ( ( msg_len | 15 ) + 1 ) * 16,
+         max_len = 256 + (size_t) fl.cnt * 64;
+  for (;;) {
+    if ( max_len > limit )
+      max_len = limit;
+    char * start = spc.str_make( max_len );
+    bool   ok;
+    switch ( enc ) {
+      case NATS_ENC_RV: {
+        RvMsgWriter rvmsg( spc, start, max_len );
+        ok = write_fields( rvmsg, *iter, fl, false );
+        if ( ok ) {
+          out_len = rvmsg.update_hdr();
+          out     = (char *) rvmsg.buf;
+        }
+        break;
+      }
+      case NATS_ENC_TIBMSG: {
+        TibMsgWriter tibmsg( spc, start, max_len );
+        ok = write_fields( tibmsg, *iter, fl, false );
+        if ( ok ) {
+          out_len = tibmsg.update_hdr();
+          out     = (char *) tibmsg.buf;
+        }
+        break;
+      }
+      default: {
+        NatsJsonWriter jmsg( spc, start, max_len );
+        ok = write_fields( jmsg, *iter, fl, true ) && jmsg.finish();
+        if ( ok ) {
+          out_len = jmsg.off;
+          out     = jmsg.buf;
+        }
+        break;
+      }
+    }
+    if ( ok )
+      return true;
+    if ( max_len == limit )
+      return false;
+    max_len *= 2;
+  }
+}
+
+/* the entry at p, <u8 name len><name><u8 type><u32 size><data> */
+static inline uint32_t
+image_entry_size( const char *p ) noexcept
+{
+  uint8_t  n = (uint8_t) p[ 0 ];
+  uint32_t size;
+  ::memcpy( &size, &p[ 1 + n + 1 ], 4 );
+  return 1 + n + 1 + 4 + size;
+}
+
+bool
+rai::natsmd::nats_delta( MDMsgMem &spc,  const void *msg,  size_t msg_len,
+                         NatsFieldImage &img,  bool full,  char *&out,
+                         size_t &out_len ) noexcept
+{
+  MDFieldIter * iter;
+  MDMsg * m = MDMsg::unpack( (void *) msg, 0, msg_len, 0, NULL, spc );
+  if ( m == NULL || m->get_field_iter( iter ) != 0 )
+    return false;
+
+  /* index the image entries, seen[] marks the ones this msg updates */
+  const char * end = &img.buf[ img.buf_len ],
+             * p;
+  uint32_t     n = 0, i, j;
+  for ( p = img.buf; p < end; p = &p[ image_entry_size( p ) ] )
+    n++;
+  uint32_t * idx  = (uint32_t *) spc.make( sizeof( uint32_t ) * ( n + 1 ) );
+  uint8_t  * seen = (uint8_t *) spc.make( n + 1 );
+  for ( p = img.buf, i = 0; p < end; p = &p[ image_entry_size( p ) ] )
+    idx[ i++ ] = (uint32_t) ( p - img.buf );
+
+  /* an entry is at most 4 bytes more than the field encoded in the msg,
+   * a full update also prints the image fields which the msg does not have */
+  size_t img_size = img.buf_len + msg_len * 3 + 256,
+         src_len  = msg_len + ( full ? img.buf_len : 0 ),
+         limit    = ( ( src_len | 15 ) + 1 ) * 16,
+         max_len  = src_len * 2 + 256;
+  for (;;) {
+    if ( max_len > limit )
+      max_len = limit;
+    char * nimg  = (char *) spc.make( img_size );
+    size_t noff  = 0;
+    bool   ok    = true,
+           imgok = true;
+    uint32_t hint = 0;
+    NatsJsonWriter jmsg( spc, spc.str_make( max_len ), max_len );
+    MDReference    last; /* the endian of the msg, for the image fields */
+
+    ::memset( &last, 0, sizeof( last ) );
+    last.fendian = MD_BIG;
+    ::memset( seen, 0, n + 1 );
+    if ( iter->first() == 0 ) {
+      do {
+        MDName      name;
+        MDReference mref;
+        if ( iter->get_name( name ) != 0 || iter->get_reference( mref ) != 0 )
+          continue;
+        last = mref;
+        size_t nlen    = name.fnamelen;
+        bool   changed = true;
+        if ( nlen <= 255 ) {
+          /* fields usually repeat in order, start after the last match */
+          for ( j = 0; j < n; j++ ) {
+            i = ( hint + j < n ? hint + j : hint + j - n );
+            const char * e = &img.buf[ idx[ i ] ];
+            if ( (uint8_t) e[ 0 ] == nlen &&
+                 ::memcmp( &e[ 1 ], name.fname, nlen ) == 0 )
+              break;
+          }
+          if ( j < n ) {
+            const char * e = &img.buf[ idx[ i ] ];
+            uint32_t     size;
+            ::memcpy( &size, &e[ 1 + nlen + 1 ], 4 );
+            changed = ( (uint8_t) e[ 1 + nlen ] != (uint8_t) mref.ftype ||
+                        size != mref.fsize ||
+                        ::memcmp( &e[ 1 + nlen + 1 + 4 ], mref.fptr,
+                                  size ) != 0 );
+            seen[ i ] = 1;
+            hint      = i + 1;
+          }
+          size_t esz = 1 + nlen + 1 + 4 + mref.fsize;
+          if ( noff + esz <= img_size ) {
+            uint32_t size = (uint32_t) mref.fsize;
+            nimg[ noff ] = (char) nlen;
+            ::memcpy( &nimg[ noff + 1 ], name.fname, nlen );
+            nimg[ noff + 1 + nlen ] = (char) mref.ftype;
+            ::memcpy( &nimg[ noff + 1 + nlen + 1 ], &size, 4 );
+            ::memcpy( &nimg[ noff + 1 + nlen + 1 + 4 ], mref.fptr, size );
+            noff += esz;
+          }
+          else {
+            imgok = false;
+          }
+        }
+        if ( changed || full ) {
+          if ( nlen > 0 && name.fname[ nlen - 1 ] == '\0' )
+            nlen--;
+          if ( jmsg.append_ref( name.fname, nlen, mref ) != 0 ) {
+            ok = false;
+            break;
+          }
+        }
+      } while ( iter->next() == 0 );
+    }
+    /* a full update is the whole image, which has the fields of earlier
+     * msgs that this one does not update */
+    for ( i = 0; ok && full && i < n; i++ ) {
+      if ( seen[ i ] )
+        continue;
+      const char * e    = &img.buf[ idx[ i ] ];
+      size_t       nlen = (uint8_t) e[ 0 ];
+      uint32_t     size;
+      MDReference  mref = last;
+      ::memcpy( &size, &e[ 1 + nlen + 1 ], 4 );
+      mref.fptr  = (uint8_t *) &e[ 1 + nlen + 1 + 4 ];
+      mref.fsize = size;
+      mref.ftype = (MDType) (uint8_t) e[ 1 + nlen ];
+      if ( nlen > 0 && e[ nlen ] == '\0' )
+        nlen--;
+      if ( jmsg.append_ref( &e[ 1 ], nlen, mref ) != 0 )
+        ok = false;
+    }
+    if ( ok && jmsg.finish() ) {
+      /* keep the fields of the image which the msg did not update */
+      for ( i = 0; i < n; i++ ) {
+        if ( seen[ i ] )
+          continue;
+        const char * e   = &img.buf[ idx[ i ] ];
+        uint32_t     esz = image_entry_size( e );
+        if ( noff + esz <= img_size ) {
+          ::memcpy( &nimg[ noff ], e, esz );
+          noff += esz;
+        }
+        else {
+          imgok = false;
+        }
+      }
+      /* an image which is lost is empty, the next msg is sent in full */
+      if ( imgok && noff > img.buf_size ) {
+        char * b = (char *) ::realloc( img.buf, noff );
+        if ( b == NULL )
+          imgok = false;
+        else {
+          img.buf      = b;
+          img.buf_size = (uint32_t) noff;
+        }
+      }
+      if ( imgok ) {
+        ::memcpy( img.buf, nimg, noff );
+        img.buf_len = (uint32_t) noff;
+      }
+      else {
+        img.buf_len = 0;
+      }
+      out     = jmsg.buf;
+      out_len = jmsg.off;
+      return true;
+    }
+    if ( max_len == limit )
+      return false;
+    max_len *= 2;
+  }
+}
@@ -0,0 +1,777 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#if ! defined( _MSC_VER ) && ! defined( __MINGW32__ )
+#include <unistd.h>
+#else
+#include <raikv/win.h>
+#endif
+#include <natsmd/ev_nats.h>
+#include <natsmd/nats_sys.h>
+#include <natsmd/nats_hot.h>
+#include <natsmd/nats_trace.h>
+#include <natsmd/nats_metrics.h>
+#include <raikv/key_hash.h>
+#include <raikv/util.h>
+#include <raikv/ev_publish.h>
+#include <hdr_histogram.h>
+
+using namespace rai;
+using namespace natsmd;
+using namespace kv;
+using namespace md;
+
+NatsSysKind
+rai::natsmd::nats_sys_kind( const char *sub,  size_t sublen ) noexcept
+{
+  size_t off = sublen;
+  while ( off > 0 && sub[ off - 1 ] != '.' )
+    off--;
+  const char * kind     = &sub[ off ];
+  size_t       kind_len = sublen - off;
+
+  if ( kind_len == 5 && ::memcmp( kind, "SUBSZ", 5 ) == 0 )
+    return NATS_SYS_SUBSZ;
+  if ( kind_len == 4 && ::memcmp( kind, "VARZ", 4 ) == 0 )
+    return NATS_SYS_VARZ;
+  if ( kind_len == 5 && ::memcmp( kind, "CONNZ", 5 ) == 0 )
+    return NATS_SYS_CONNZ;
+  if ( kind_len == 4 && ::memcmp( kind, "LATZ", 4 ) == 0 )
+    return NATS_SYS_LATZ;
+  if ( kind_len == 4 && ::memcmp( kind, "HOTZ", 4 ) == 0 )
+    return NATS_SYS_HOTZ;
+  if ( kind_len == 5 && ::memcmp( kind, "TRACE", 5 ) == 0 )
+    return NATS_SYS_TRACE;
+  if ( kind_len == 7 && ::memcmp( kind, "METRICS", 7 ) == 0 )
+    return NATS_SYS_METRICS;
+  return NATS_SYS_NONE;
+}
+
+uint64_t
+rai::natsmd::nats_sys_param( const char *msg,  size_t len,  const char *name,
+                             uint64_t dflt ) noexcept
+{
+  size_t namelen = ::strlen( name );
+  const char * end = &msg[ len ];
+  for ( const char * p = msg; p + namelen + 2 < end; p++ ) {
+    if ( p[ 0 ] != '\"' || ::memcmp( &p[ 1 ], name, namelen ) != 0 ||
+         p[ namelen + 1 ] != '\"' )
+      continue;
+    p = &p[ namelen + 2 ];
+    while ( p < end && ( *p == ' ' || *p == ':' ) )
+      p++;
+    if ( p == end || *p < '0' || *p > '9' )
+      return dflt;
+    uint64_t n = 0;
+    while ( p < end && *p >= '0' && *p <= '9' )
+      n = n * 10 + (uint64_t) ( *p++ - '0' );
+    return n;
+  }
+  return dflt;
+}
+
+bool
+NatsSysBuf::make( size_t sz ) noexcept
+{
+  if ( this->off + sz <= this->len )
+    return true;
+  size_t newlen = ( this->len == 0 ? 1024 : this->len );
+  while ( newlen < this->off + sz )
+    newlen *= 2;
+  char * p = (char *) ::realloc( this->buf, newlen );
+  if ( p == NULL )
+    return false;
+  this->buf = p;
+  this->len = newlen;
+  return true;
+}
+
+NatsSysBuf &
+NatsSysBuf::b( const void *s,  size_t sz ) noexcept
+{
+  if ( this->make( sz ) ) {
+    ::memcpy( &this->buf[ this->off ], s, sz );
+    this->off += sz;
+  }
+  return *this;
+}
+
+NatsSysBuf &
+NatsSysBuf::u( uint64_t n ) noexcept
+{
+  size_t digits = uint64_digits( n );
+  if ( this->make( digits ) ) {
+    uint64_to_string( n, &this->buf[ this->off ], digits );
+    this->off += digits;
+  }
+  return *this;
+}
+
+NatsSysBuf &
+NatsSysBuf::i( int64_t n ) noexcept
+{
+  if ( n < 0 )
+    return this->c( '-' ).u( (uint64_t) -n );
+  return this->u( (uint64_t) n );
+}
+
+NatsSysBuf &
+NatsSysBuf::q( const char *s,  size_t sz ) noexcept
+{
+  static const char hex[] = "0123456789abcdef";
+  if ( ! this->make( sz * 6 + 2 ) )
+    return *this;
+  char * p = &this->buf[ this->off ];
+  *p++ = '\"';
+  for ( size_t j = 0; j < sz; j++ ) {
+    uint8_t c = (uint8_t) s[ j ];
+    if ( c == '\"' || c == '\\' ) {
+      *p++ = '\\';
+      *p++ = (char) c;
+    }
+    else if ( c < ' ' ) {
+      *p++ = '\\'; *p++ = 'u'; *p++ = '0'; *p++ = '0';
+      *p++ = hex[ c >> 4 ];
+      *p++ = hex[ c & 15 ];
+    }
+    else {
+      *p++ = (char) c;
+    }
+  }
+  *p++ = '\"';
+  this->off = p - this->buf;
+  return *this;
+}
+
+NatsSysBuf &
+NatsSysBuf::arr( const char *name,  const uint32_t *n,  size_t cnt ) noexcept
+{
+  this->c( '\"' ).s( name ).s( "\":[" );
+  for ( size_t j = 0; j < cnt; j++ ) {
+    if ( j > 0 )
+      this->c( ',' );
+    this->u( n[ j ] );
+  }
+  return this->s( "]," );
+}
+
+NatsSysBuf &
+NatsSysBuf::tab_stats( const char *name,  const NatsTabStats &st ) noexcept
+{
+  this->c( '\"' ).s( name ).s( "\":{" )
+      .fld( "count", st.count )
+      .fld( "bytes", st.bytes )
+      .fld( "collisions", st.collisions )
+      .fld( "max_chain", st.max_chain )
+      .arr( "chain_hist", st.chain_hist, NatsTabStats::HIST_SIZE );
+  return this->close( '}' ).c( ',' );
+}
+
+NatsSysBuf &
+NatsSysBuf::lat_hist( const char *name,  const hdr_histogram *h ) noexcept
+{
+  this->c( '\"' ).s( name ).s( "\":{" );
+  if ( h != NULL && h->total_count > 0 ) {
+    this->fld( "count", (uint64_t) h->total_count )
+        .fld( "min", (uint64_t) hdr_min( h ) )
+        .fld( "mean", (uint64_t) hdr_mean( h ) )
+        .fld( "p50", (uint64_t) hdr_value_at_percentile( h, 50.0 ) )
+        .fld( "p90", (uint64_t) hdr_value_at_percentile( h, 90.0 ) )
+        .fld( "p99", (uint64_t) hdr_value_at_percentile( h, 99.0 ) )
+        .fld( "p999", (uint64_t) hdr_value_at_percentile( h, 99.9 ) )
+        .fld( "max", (uint64_t) hdr_max( h ) );
+  }
+  else {
+    this->fld( "count", 0 );
+  }
+  return this->close( '}' ).c( ',' );
+}
+
+uint64_t
+rai::natsmd::nats_latency_window_ns( void ) noexcept
+{
+  const char * val = ::getenv( "NATSMD_LATENCY" );
+  if ( val == NULL || val[ 0 ] < '0' || val[ 0 ] > '9' )
+    return 0;
+  return (uint64_t) ::strtoull( val, NULL, 10 ) * 1000000000;
+}
+
+/* 1ns to 60s, 2 significant digits, about 30k per histogram */
+static const int64_t NATS_LAT_MAX_NS = (int64_t) 60 * 1000000000;
+static const int     NATS_LAT_DIGITS = 2;
+
+bool
+NatsLatHist::init( uint64_t win_ns ) noexcept
+{
+  this->cur = this->prev = NULL;
+  this->window_start = kv_current_monotonic_time_ns();
+  this->window_ns    = win_ns;
+  if ( hdr_init( 1, NATS_LAT_MAX_NS, NATS_LAT_DIGITS, &this->cur ) != 0 ||
+       hdr_init( 1, NATS_LAT_MAX_NS, NATS_LAT_DIGITS, &this->prev ) != 0 ) {
+    this->release();
+    return false;
+  }
+  return true;
+}
+
+void
+NatsLatHist::release( void ) noexcept
+{
+  if ( this->cur != NULL )
+    hdr_close( this->cur );
+  if ( this->prev != NULL )
+    hdr_close( this->prev );
+  this->cur = this->prev = NULL;
+}
+
+void
+NatsLatHist::rotate( uint64_t now ) noexcept
+{
+  hdr_histogram * h = this->prev;
+  this->prev = this->cur;
+  this->cur  = h;
+  hdr_reset( h );
+  this->window_start = now;
+}
+
+void
+NatsLatHist::record_value( uint64_t lat ) noexcept
+{
+  if ( lat > (uint64_t) NATS_LAT_MAX_NS )
+    lat = NATS_LAT_MAX_NS;
+  hdr_record_value( this->cur, (int64_t) lat );
+}
+
+NatsLatency *
+NatsLatency::create( uint64_t win_ns ) noexcept
+{
+  NatsLatency * l = (NatsLatency *) ::malloc( sizeof( NatsLatency ) );
+  if ( l == NULL )
+    return NULL;
+  l->write_stamp = 0;
+  if ( ! l->fwd.init( win_ns ) ) {
+    ::free( l );
+    return NULL;
+  }
+  if ( ! l->write.init( win_ns ) ) {
+    l->fwd.release();
+    ::free( l );
+    return NULL;
+  }
+  return l;
+}
+
+void
+NatsLatency::release( void ) noexcept
+{
+  this->fwd.release();
+  this->write.release();
+  ::free( this );
+}
+
+/* find the next nats connection accepted by listener */
+static EvNatsService *
+next_service( EvNatsListen &l,  int &fd ) noexcept
+{
+  EvPoll & poll = l.poll;
+  for ( ; fd <= (int) poll.maxfd; fd++ ) {
+    EvSocket * s = poll.sock[ fd ];
+    if ( s != NULL && s->sock_type == l.accept_sock_type ) {
+      EvNatsService * svc = static_cast<EvNatsService *>( s );
+      if ( &svc->listen == &l ) {
+        fd++;
+        return svc;
+      }
+    }
+  }
+  return NULL;
+}
+
+/* the reports show the peers, users and subscriptions of every connection
+ * and TRACE changes the process, only the admin user configured may ask */
+bool
+EvNatsService::sys_allowed( void ) const noexcept
+{
+  const char * u = this->listen.sys_user,
+             * p = this->listen.sys_pass;
+  if ( u == NULL || this->user.user == NULL ||
+       ::strcmp( u, this->user.user ) != 0 )
+    return false;
+  return p == NULL ||
+         ( this->user.pass != NULL && ::strcmp( p, this->user.pass ) == 0 );
+}
+
+bool
+EvNatsService::sys_request( NatsMsg &msg,  const char *rep,
+                            size_t replen ) noexcept
+{
+  NatsSysBuf out;
+  switch ( nats_sys_kind( msg.subject, msg.subject_len ) ) {
+    case NATS_SYS_SUBSZ: this->sys_subsz( out, msg ); break;
+    case NATS_SYS_VARZ:  this->sys_varz( out ); break;
+    case NATS_SYS_CONNZ: this->sys_connz( out, msg ); break;
+    case NATS_SYS_LATZ:  this->sys_latz( out, msg ); break;
+    case NATS_SYS_HOTZ:  this->sys_hotz( out, msg ); break;
+    case NATS_SYS_TRACE: this->sys_trace( out, msg ); break;
+    case NATS_SYS_METRICS: this->sys_metrics( out ); break;
+    default: return false;
+  }
+  if ( is_nats_debug )
+    printf( "sys_request %.*s -> %.*s (%u bytes)\n",
+            (int) msg.subject_len, msg.subject, (int) replen, rep,
+            (uint32_t) out.off );
+  this->sys_reply( rep, replen, out.buf, out.off );
+  return true;
+}
+
+/* publish the reply to the bus, the src is the listener so that the
+ * requester receives it even when echo is off */
+void
+EvNatsService::sys_reply( const char *rep,  size_t replen,  const void *data,
+                          size_t datalen ) noexcept
+{
+  uint32_t  h = kv_crc_c( rep, replen, 0 );
+  EvPublish pub( rep, replen, NULL, 0, data, datalen,
+                 this->sub_route, this->listen, h, MD_STRING );
+  this->sub_route.forward_msg( pub );
+}
+
+struct NatsSubszEntry {
+  EvNatsService * svc;
+  NatsMapStats    st;
+  bool            detail; /* st is from stats(), otherwise counts() */
+};
+
+/* most collisions first, these are the maps which are slowest to lookup */
+static int
+cmp_subsz( const void *x,  const void *y ) noexcept
+{
+  const NatsSubszEntry * a = (const NatsSubszEntry *) x,
+                       * b = (const NatsSubszEntry *) y;
+  uint64_t ca = (uint64_t) a->st.total_collisions() + a->st.max_per_prefix,
+           cb = (uint64_t) b->st.total_collisions() + b->st.max_per_prefix;
+  return ca > cb ? -1 : ca < cb ? 1 : 0;
+}
+
+/* the maps of the connections in offset, limit are walked, paged the same
+ * as connz, the limit is at most NATS_SYS_SUBSZ_LIMIT since each walks all
+ * of the subs of a connection; the walks of a page visit at most
+ * NATS_SYS_SUBSZ_VISIT entries, the page ends early when the next map does
+ * not fit, a map which would not fit an empty page is only counted; sorted
+ * by collisions within the page */
+void
+EvNatsService::sys_subsz( NatsSysBuf &out,  NatsMsg &msg ) noexcept
+{
+  NatsSubszEntry * ent;
+  EvNatsService  * svc;
+  uint64_t         offset = nats_sys_param( msg.msg_ptr, msg.msg_len,
+                                            "offset", 0 ),
+                   limit  = nats_sys_param( msg.msg_ptr, msg.msg_len,
+                                            "limit", NATS_SYS_SUBSZ_LIMIT ),
+                   total  = 0,
+                   next;
+  size_t           cnt    = 0,
+                   visit  = NATS_SYS_SUBSZ_VISIT,
+                   n;
+  int              fd     = 0;
+  bool             full   = false; /* page ended by the visit budget */
+
+  if ( limit > NATS_SYS_SUBSZ_LIMIT )
+    limit = NATS_SYS_SUBSZ_LIMIT;
+  ent = (NatsSubszEntry *) ::malloc( sizeof( ent[ 0 ] ) * ( limit + 1 ) );
+  if ( ent == NULL )
+    limit = 0;
+  while ( (svc = next_service( this->listen, fd )) != NULL ) {
+    if ( total++ < offset || cnt >= limit || full )
+      continue;
+    n = svc->map.entry_count();
+    ent[ cnt ].svc = svc;
+    if ( n <= visit ) {
+      svc->map.stats( ent[ cnt ].st );
+      ent[ cnt ].detail = true;
+      visit -= n;
+    }
+    else if ( n > NATS_SYS_SUBSZ_VISIT ) {
+      svc->map.counts( ent[ cnt ].st );
+      ent[ cnt ].detail = false;
+    }
+    else {
+      full = true; /* the next page has it */
+      continue;
+    }
+    cnt++;
+  }
+  next = offset + cnt;
+  if ( cnt > 1 )
+    ::qsort( ent, cnt, sizeof( ent[ 0 ] ), cmp_subsz );
+
+  out.s( "{\"server_id\":" ).q( nats_server_id(), 22 ).c( ',' )
+     .fld( "now", kv_current_realtime_ns() )
+     .fld( "offset", offset )
+     .fld( "limit", limit )
+     .fld( "num_connections", cnt )
+     .fld( "total", total )
+     .fld( "next", next < total ? next : 0 )
+     .s( "\"connections\":[" );
+  for ( size_t j = 0; j < cnt; j++ ) {
+    NatsMapStats & st = ent[ j ].st;
+    svc = ent[ j ].svc;
+    out.c( '{' ).fld( "cid", (uint64_t) svc->fd );
+    if ( svc->user.name != NULL )
+      out.s( "\"name\":" ).q( svc->user.name, ::strlen( svc->user.name ) )
+         .c( ',' );
+    if ( svc->user.user != NULL )
+      out.s( "\"user\":" ).q( svc->user.user, ::strlen( svc->user.user ) )
+         .c( ',' );
+    out.bol( "detail", ent[ j ].detail )
+       .fld( "subjects", st.sub.count + st.qsub.count )
+       .fld( "prefixes", st.pat.count + st.qpat.count )
+       .fld( "sids", st.sid.count );
+    if ( ! ent[ j ].detail ) {
+      out.close( '}' ).c( ',' );
+      continue;
+    }
+    out.fld( "patterns", st.wild_count )
+       .fld( "bytes", st.total_bytes() )
+       .fld( "collisions", st.total_collisions() )
+       .fld( "max_per_prefix", st.max_per_prefix );
+    if ( st.max_per_prefix > 0 )
+      out.s( "\"max_prefix\":" ).q( st.max_prefix, st.max_prefix_len )
+         .c( ',' );
+    out.arr( "per_prefix_hist", st.per_prefix_hist, NatsMapStats::HIST_SIZE )
+       .arr( "sid_hist", st.sid_hist, NatsMapStats::HIST_SIZE )
+       .tab_stats( "sub_tab", st.sub )
+       .tab_stats( "qsub_tab", st.qsub )
+       .tab_stats( "pat_tab", st.pat )
+       .tab_stats( "qpat_tab", st.qpat )
+       .tab_stats( "sid_tab", st.sid )
+       .close( '}' ).c( ',' );
+  }
+  out.close( ']' ).s( "}" );
+  if ( ent != NULL )
+    ::free( ent );
+}
+
+/* listener totals, the live connection counters are added to the counters
+ * of the connections already closed */
+void
+NatsVarz::gather( EvNatsListen &l ) noexcept
+{
+  NatsListenStats & ls = l.stats;
+  EvNatsService   * svc;
+  int               fd = 0;
+
+  this->msgs_recv    = ls.msgs_recv;
+  this->msgs_sent    = ls.msgs_sent;
+  this->bytes_recv   = ls.bytes_recv;
+  this->bytes_sent   = ls.bytes_sent;
+  this->pending      = 0;
+  this->subs         = 0;
+  this->slow_drops   = ls.slow_drops;
+  this->backpressure = ls.backpressure;
+  this->converts     = ls.converts;
+  this->zero_refs    = ls.zero_refs;
+  this->zero_ref_bytes = ls.zero_ref_bytes;
+  this->flush_timers = ls.flush_timers;
+  this->read_calls   = ls.read_calls;
+  this->write_calls  = ls.write_calls;
+  this->xf_hits      = 0;
+  this->xf_misses    = 0;
+  this->xf_grows     = 0;
+  for ( int i = 0; i < NATS_ENC_CONVERT; i++ ) {
+    this->xf_hits   += l.xf_cache[ i ].hits;
+    this->xf_misses += l.xf_cache[ i ].misses;
+    this->xf_grows  += l.xf_cache[ i ].grows;
+  }
+  this->cnt          = 0;
+  this->bp_cnt       = 0;
+  this->slow_cnt     = 0;
+  while ( (svc = next_service( l, fd )) != NULL ) {
+    this->cnt++;
+    this->msgs_recv    += svc->msgs_recv;
+    this->msgs_sent    += svc->msgs_sent;
+    this->bytes_recv   += svc->bytes_recv;
+    this->bytes_sent   += svc->bytes_sent;
+    this->pending      += svc->pending();
+    this->subs         += svc->map.sid_tab.pop_count();
+    this->slow_drops   += svc->slow_drops;
+    this->backpressure += svc->backpressure_cnt;
+    this->converts     += svc->convert_cnt;
+    this->zero_refs    += svc->zero_ref_cnt;
+    this->zero_ref_bytes += svc->zero_ref_bytes;
+    this->flush_timers += svc->flush_timer_cnt;
+    this->read_calls   += svc->read_calls;
+    this->write_calls  += svc->write_calls;
+    if ( ( svc->nats_state & NATS_BACKPRESSURE ) != 0 )
+      this->bp_cnt++;
+    if ( ( svc->nats_state & NATS_BUFFERSIZE ) != 0 )
+      this->slow_cnt++;
+  }
+}
+
+void
+EvNatsService::sys_varz( NatsSysBuf &out ) noexcept
+{
+  NatsListenStats & ls  = this->listen.stats;
+  uint64_t          now = kv_current_realtime_ns();
+  NatsVarz          v;
+
+  v.gather( this->listen );
+  out.s( "{\"server_id\":" ).q( nats_server_id(), 22 ).c( ',' )
+     .fld( "now", now )
+     .fld( "start", ls.start_ns )
+     .fld( "uptime_ns", now > ls.start_ns ? now - ls.start_ns : 0 )
+     .fld( "connections", v.cnt )
+     .fld( "total_connections", ls.accept_cnt )
+     .fld( "closed_connections", ls.close_cnt )
+     .fld( "subscriptions", v.subs )
+     .fld( "in_msgs", v.msgs_recv )
+     .fld( "out_msgs", v.msgs_sent )
+     .fld( "in_bytes", v.bytes_recv )
+     .fld( "out_bytes", v.bytes_sent )
+     .fld( "pending_bytes", v.pending )
+     .fld( "backpressure", v.bp_cnt )
+     .fld( "backpressure_events", v.backpressure )
+     .fld( "buffersize", v.slow_cnt )
+     .fld( "max_pending", this->listen.max_pending )
+     .fld( "slow_consumer_drops", v.slow_drops )
+     .fld( "slow_consumer_closes", ls.slow_closes )
+     .fld( "transform_conversions", v.converts )
+     .fld( "transform_cache_hits", v.xf_hits )
+     .fld( "transform_cache_misses", v.xf_misses )
+     .fld( "transform_buffer_grows", v.xf_grows )
+     .fld( "zero_copy_refs", v.zero_refs )
+     .fld( "zero_copy_bytes", v.zero_ref_bytes )
+     .fld( "zero_copy_min", this->listen.zero_copy_min )
+     .fld( "read_calls", v.read_calls )
+     .fld( "write_calls", v.write_calls )
+     .fld( "flush_usecs", this->listen.flush_usecs )
+     .fld( "flush_bytes", this->listen.flush_bytes )
+     .fld( "flush_timers", v.flush_timers )
+     .close( '}' );
+}
+
+/* the counters of each connection, the payload may contain offset and limit
+ * so that a large number of connections is paged over several requests,
+ * limit is at most NATS_SYS_CONNZ_LIMIT; only the admin may ask, since it
+ * has the peer address and user of each connection */
+void
+EvNatsService::sys_connz( NatsSysBuf &out,  NatsMsg &msg ) noexcept
+{
+  EvNatsService * svc;
+  uint64_t        offset = nats_sys_param( msg.msg_ptr, msg.msg_len,
+                                           "offset", 0 ),
+                  limit  = nats_sys_param( msg.msg_ptr, msg.msg_len,
+                                           "limit", NATS_SYS_CONNZ_LIMIT ),
+                  now    = this->poll.now_ns,
+                  total  = 0,
+                  cnt    = 0;
+  int             fd     = 0;
+
+  if ( limit > NATS_SYS_CONNZ_LIMIT )
+    limit = NATS_SYS_CONNZ_LIMIT;
+
+  out.s( "{\"server_id\":" ).q( nats_server_id(), 22 ).c( ',' )
+     .fld( "now", kv_current_realtime_ns() )
+     .fld( "offset", offset )
+     .fld( "limit", limit )
+     .s( "\"connections\":[" );
+  while ( (svc = next_service( this->listen, fd )) != NULL ) {
+    if ( total++ < offset || cnt >= limit )
+      continue;
+    cnt++;
+    out.c( '{' ).fld( "cid", (uint64_t) svc->fd )
+       .str( "ip", svc->peer_address.buf, svc->get_peer_address_strlen() );
+    if ( svc->user.name != NULL )
+      out.str( "name", svc->user.name, ::strlen( svc->user.name ) );
+    if ( svc->user.lang != NULL )
+      out.str( "lang", svc->user.lang, ::strlen( svc->user.lang ) );
+    if ( svc->user.version != NULL )
+      out.str( "version", svc->user.version, ::strlen( svc->user.version ) );
+    if ( svc->user.user != NULL )
+      out.str( "user", svc->user.user, ::strlen( svc->user.user ) );
+    out.fld( "start", svc->user.stamp )
+       .fld( "uptime_ns", svc->user.stamp != 0 && now > svc->user.stamp ?
+                          now - svc->user.stamp : 0 )
+       .fld( "idle_ns", now > svc->active_ns ? now - svc->active_ns : 0 )
+       .fld( "in_msgs", svc->msgs_recv )
+       .fld( "out_msgs", svc->msgs_sent )
+       .fld( "in_bytes", svc->bytes_recv )
+       .fld( "out_bytes", svc->bytes_sent )
+       .fld( "pending_bytes", svc->pending() )
+       .bol( "backpressure", ( svc->nats_state & NATS_BACKPRESSURE ) != 0 )
+       .bol( "buffersize", ( svc->nats_state & NATS_BUFFERSIZE ) != 0 )
+       .bol( "stalled", svc->bp_in_list() )
+       .fld( "slow_consumer_drops", svc->slow_drops )
+       .str( "encoding", nats_encoding_name( svc->user.encoding ),
+             ::strlen( nats_encoding_name( svc->user.encoding ) ) )
+       .bol( "conflate", svc->user.conflate )
+       .fld( "conflate_pending", svc->conflate_cnt )
+       .fld( "conflated", svc->conflated )
+       .fld( "backpressure_events", svc->backpressure_cnt )
+       .fld( "transform_conversions", svc->convert_cnt )
+       .fld( "zero_copy_refs", svc->zero_ref_cnt )
+       .fld( "zero_copy_bytes", svc->zero_ref_bytes )
+       .fld( "read_calls", svc->read_calls )
+       .fld( "write_calls", svc->write_calls )
+       .fld( "flush_timers", svc->flush_timer_cnt )
+       .fld( "projected_msgs", svc->proj_cnt )
+       .bol( "delta", svc->user.delta )
+       .fld( "delta_msgs", svc->delta_cnt )
+       .fld( "delta_bytes_saved", svc->delta_saved )
+       .fld( "delta_images", svc->image_tab == NULL ? 0 :
+                             svc->image_tab->pop_count() )
+       .fld( "delta_image_bytes", svc->image_bytes )
+       .fld( "delta_evictions", svc->delta_evicts )
+       .fld( "projections", svc->proj_tab == NULL ? 0 :
+                            svc->proj_tab->pop_count() )
+       .fld( "subscriptions", svc->map.sid_tab.pop_count() )
+       .fld( "subjects", svc->map.sub_tab.pop_count() +
+                         svc->map.qsub_tab.pop_count() )
+       .close( '}' ).c( ',' );
+  }
+  out.close( ']' ).c( ',' )
+     .fld( "num_connections", cnt )
+     .fld( "total", total )
+     .close( '}' );
+}
+
+/* latency histograms of each connection, in nanoseconds, paged the same as
+ * connz; prev is the last complete window, cur is the window filling */
+void
+EvNatsService::sys_latz( NatsSysBuf &out,  NatsMsg &msg ) noexcept
+{
+  EvNatsService * svc;
+  uint64_t        offset = nats_sys_param( msg.msg_ptr, msg.msg_len,
+                                           "offset", 0 ),
+                  limit  = nats_sys_param( msg.msg_ptr, msg.msg_len,
+                                           "limit", NATS_SYS_CONNZ_LIMIT ),
+                  now    = kv_current_monotonic_time_ns(),
+                  total  = 0,
+                  cnt    = 0;
+  int             fd     = 0;
+
+  if ( limit > NATS_SYS_CONNZ_LIMIT )
+    limit = NATS_SYS_CONNZ_LIMIT;
+
+  out.s( "{\"server_id\":" ).q( nats_server_id(), 22 ).c( ',' )
+     .fld( "now", kv_current_realtime_ns() )
+     .fld( "window_ns", this->listen.lat_window_ns )
+     .s( "\"connections\":[" );
+  while ( (svc = next_service( this->listen, fd )) != NULL ) {
+    if ( svc->lat == NULL )
+      continue;
+    if ( total++ < offset || cnt >= limit )
+      continue;
+    cnt++;
+    NatsLatency & l = *svc->lat;
+    /* rotate idle windows so that prev is not stale */
+    if ( now - l.fwd.window_start >= l.fwd.window_ns )
+      l.fwd.rotate( now );
+    if ( now - l.write.window_start >= l.write.window_ns )
+      l.write.rotate( now );
+    out.c( '{' ).fld( "cid", (uint64_t) svc->fd );
+    if ( svc->user.name != NULL )
+      out.str( "name", svc->user.name, ::strlen( svc->user.name ) );
+    out.lat_hist( "fwd", l.fwd.prev )
+       .lat_hist( "fwd_cur", l.fwd.cur )
+       .lat_hist( "write", l.write.prev )
+       .lat_hist( "write_cur", l.write.cur )
+       .close( '}' ).c( ',' );
+  }
+  out.close( ']' ).c( ',' )
+     .fld( "num_connections", cnt )
+     .fld( "total", total )
+     .close( '}' );
+}
+
+static void
+hot_top( NatsSysBuf &out,  const char *name,  const NatsHotHeap &heap ) noexcept
+{
+  NatsHotEntry top[ NatsHotHeap::TOP_N ];
+  uint32_t     n = heap.sorted( top );
+  out.c( '\"' ).s( name ).s( "\":[" );
+  for ( uint32_t i = 0; i < n; i++ )
+    out.c( '{' ).str( "subject", top[ i ].subj, top[ i ].len )
+       .fld( "count", top[ i ].count ).close( '}' ).c( ',' );
+  out.close( ']' ).c( ',' );
+}
+
+static void
+hot_track( NatsSysBuf &out,  const char *name,  NatsHotTrack *t ) noexcept
+{
+  out.c( '\"' ).s( name ).s( "\":{" );
+  if ( t != NULL ) {
+    out.fld( "start", t->start_ns )
+       .fld( "sample", t->sample )
+       .fld( "msgs", t->total_msgs )
+       .fld( "bytes", t->total_bytes );
+    hot_top( out, "top_msgs", t->top_msgs );
+    hot_top( out, "top_bytes", t->top_bytes );
+  }
+  out.close( '}' ).c( ',' );
+}
+
+/* top subjects by msgs and bytes, published and delivered, the counts are
+ * sketch estimates which may over count; {"reset":1} starts over */
+void
+EvNatsService::sys_hotz( NatsSysBuf &out,  NatsMsg &msg ) noexcept
+{
+  EvNatsListen & l = this->listen;
+  out.s( "{\"server_id\":" ).q( nats_server_id(), 22 ).c( ',' )
+     .fld( "now", kv_current_realtime_ns() );
+  hot_track( out, "pub", l.hot_pub );
+  hot_track( out, "deliver", l.hot_deliver );
+  out.close( '}' );
+  if ( nats_sys_param( msg.msg_ptr, msg.msg_len, "reset", 0 ) != 0 ) {
+    if ( l.hot_pub != NULL )
+      l.hot_pub->zero();
+    if ( l.hot_deliver != NULL )
+      l.hot_deliver->zero();
+  }
+}
+
+/* {"enable":1} starts recording trace points, {"enable":0} stops,
+ * {"dump":1} writes the ring of this thread to natsmd_trace.<pid>.<id> in
+ * the NATSMD_TRACE_DIR of the operator, never to the cwd */
+void
+EvNatsService::sys_trace( NatsSysBuf &out,  NatsMsg &msg ) noexcept
+{
+  uint64_t enable = nats_sys_param( msg.msg_ptr, msg.msg_len, "enable", 2 );
+  if ( enable != 2 )
+    nats_trace_on = ( enable != 0 );
+  out.s( "{\"server_id\":" ).q( nats_server_id(), 22 ).c( ',' )
+#ifdef NATSMD_TRACE
+     .bol( "compiled", true )
+#else
+     .bol( "compiled", false )
+#endif
+     .bol( "enabled", nats_trace_on != 0 );
+  if ( nats_sys_param( msg.msg_ptr, msg.msg_len, "dump", 0 ) != 0 &&
+       nats_trace_tls != NULL ) {
+    const char * dir = this->listen.trace_dir;
+    char         path[ 1024 ];
+    int          len = -1;
+    if ( dir != NULL && dir[ 0 ] != '\0' )
+      len = ::snprintf( path, sizeof( path ), "%s/natsmd_trace.%u.%u", dir,
+                        (uint32_t) ::getpid(), nats_trace_tls->id );
+    if ( len < 0 || (size_t) len >= sizeof( path ) ) {
+      static const char err[] = "dump needs NATSMD_TRACE_DIR";
+      out.str( "error", err, sizeof( err ) - 1 );
+    }
+    else {
+      int n = nats_trace_dump( path );
+      out.str( "file", path, (size_t) len )
+         .fld( "records", n < 0 ? 0 : (uint64_t) n );
+    }
+  }
+  out.close( '}' );
+}
+
+/* the varz counters in prometheus text format, the same as http /metrics */
+void
+EvNatsService::sys_metrics( NatsSysBuf &out ) noexcept
+{
+  nats_metrics_text( this->listen, out );
+}
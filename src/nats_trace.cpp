@@ -0,0 +1,67 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <natsmd/nats_trace.h>
+
+using namespace rai;
+using namespace natsmd;
+
+uint32_t rai::natsmd::nats_trace_on = 0;
+thread_local NatsTraceRing * rai::natsmd::nats_trace_tls = NULL;
+
+static uint32_t nats_trace_ring_cnt;
+
+NatsTraceRing *
+rai::natsmd::nats_trace_ring_create( void ) noexcept
+{
+  NatsTraceRing * r = (NatsTraceRing *) ::malloc( sizeof( NatsTraceRing ) );
+  if ( r == NULL )
+    return NULL;
+  r->head = 0;
+  r->id   = nats_trace_ring_cnt++; /* label only, a race is harmless */
+  nats_trace_tls = r;
+  return r;
+}
+
+int
+rai::natsmd::nats_trace_dump( const char *path ) noexcept
+{
+  NatsTraceRing  * r = nats_trace_tls;
+  NatsTraceFileHdr hdr;
+  uint64_t         start = 0, cnt;
+
+  if ( r == NULL )
+    return 0;
+  cnt = r->head;
+  if ( cnt > NatsTraceRing::RING_SIZE ) {
+    start = cnt - NatsTraceRing::RING_SIZE;
+    cnt   = NatsTraceRing::RING_SIZE;
+  }
+  ::memset( &hdr, 0, sizeof( hdr ) );
+  ::memcpy( hdr.magic, NATS_TRACE_MAGIC, sizeof( hdr.magic ) );
+  hdr.version  = 1;
+  hdr.rec_size = sizeof( NatsTraceRec );
+  hdr.count    = (uint32_t) cnt;
+  hdr.id       = r->id;
+  hdr.lost     = start;
+
+  FILE * fp = ::fopen( path, "wb" );
+  if ( fp == NULL ) {
+    ::perror( path );
+    return -1;
+  }
+  bool ok = ( ::fwrite( &hdr, sizeof( hdr ), 1, fp ) == 1 );
+  /* oldest first, the ring may wrap once */
+  size_t i = (size_t) ( start & ( NatsTraceRing::RING_SIZE - 1 ) ),
+         n = NatsTraceRing::RING_SIZE - i;
+  if ( n > cnt )
+    n = cnt;
+  if ( ok && n > 0 )
+    ok = ( ::fwrite( &r->rec[ i ], sizeof( NatsTraceRec ), n, fp ) == n );
+  if ( ok && cnt > n )
+    ok = ( ::fwrite( r->rec, sizeof( NatsTraceRec ), cnt - n, fp ) ==
+           cnt - n );
+  ::fclose( fp );
+  return ok ? (int) cnt : -1;
+}
@@ -0,0 +1,247 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <natsmd/ev_nats.h>
+#include <natsmd/nats_json.h>
+#include <raikv/util.h>
+#include <raimd/json_msg.h>
+#include <raimd/rv_msg.h>
+#include <raimd/tib_msg.h>
+
+using namespace rai;
+using namespace natsmd;
+using namespace md;
+
+/* time converting a market data sized RV and TIBMSG msg to json, with the
+ * raimd JsonMsgWriter in the old fixed 16x buffer, with the NatsJsonWriter
+ * in the same buffer, and with the NatsXfCache estimate used by
+ * NatsMsgTransform::transform(); the quote is typed like a feed record,
+ * decimal prices, time and date fields, as test/md_pub.cpp publishes, and
+ * -f adds a captured msg (the payload bytes of a MSG) to the runs */
+
+static const char *
+get_arg( int argc, char *argv[], int b, const char *f, const char *def )
+{
+  for ( int i = 1; i < argc - b; i++ )
+    if ( ::strcmp( f, argv[ i ] ) == 0 )
+      return argv[ i + b ];
+  return def; /* default value */
+}
+
+#define F( s ) s, sizeof( s )
+/* the fields of a quote, about 30, prices are decimals / 1000 */
+template <class Writer>
+static size_t
+make_quote( Writer &w,  uint32_t n ) noexcept
+{
+  static const struct {
+    const char * fname;
+    size_t       fname_len;
+    int64_t      ival;
+  } price[] = {
+    { F( "TRDPRC_1" ), 101250 }, { F( "TRDPRC_2" ), 101240 },
+    { F( "TRDPRC_3" ), 101260 }, { F( "BID" ), 101240 },
+    { F( "ASK" ), 101270 },      { F( "HIGH_1" ), 102500 },
+    { F( "LOW_1" ), 99875 },     { F( "OPEN_PRC" ), 100000 },
+    { F( "HST_CLOSE" ), 99500 }, { F( "NETCHNG_1" ), 1750 },
+    { F( "VWAP" ), 101032 },     { F( "YRHIGH" ), 120125 },
+    { F( "YRLOW" ), 80500 }
+  };
+  MDDecimal dec;
+  MDTime    time;
+  MDDate    date;
+  char      sym[ 16 ];
+  size_t    sz = (size_t) ::snprintf( sym, sizeof( sym ), "SYM%u.N", n );
+
+  w.append_string( F( "SYMBOL" ), sym, sz + 1 )
+   .append_string( F( "DSPLY_NAME" ), F( "A TYPICAL COMPANY INC" ) )
+   .append_string( F( "CURRENCY" ), F( "USD" ) )
+   .append_string( F( "EXCHANGE" ), F( "NYS" ) )
+   .append_string( F( "HEADLINE" ),
+                   F( "ACME \"beats\" estimates,\tQ3 C:\\ACME\\Q3.PDF" ) )
+   .append_int( F( "RDNDISPLAY" ), (int32_t) 100 )
+   .append_int( F( "RDN_EXCHID" ), (int32_t) 2 )
+   .append_int( F( "SEQNUM" ), (int32_t) n )
+   .append_int( F( "ACVOL_1" ), (int64_t) 12345678 )
+   .append_int( F( "NUM_MOVES" ), (int64_t) 40211 )
+   .append_int( F( "BIDSIZE" ), (int32_t) 300 )
+   .append_int( F( "ASKSIZE" ), (int32_t) 500 )
+   .append_int( F( "TRDVOL_1" ), (int32_t) 100 )
+   .append_int( F( "PRCTCK_1" ), (uint16_t) 1 )
+   .append_real( F( "PCTCHNG" ), 1.758794 )
+   .append_real( F( "TURNOVER" ), 1246313245.5 );
+
+  for ( size_t i = 0; i < sizeof( price ) / sizeof( price[ 0 ] ); i++ ) {
+    dec.ival = price[ i ].ival;
+    dec.hint = MD_DEC_LOGn10_3; /* / 1000 */
+    w.append_decimal( price[ i ].fname, price[ i ].fname_len, dec );
+  }
+  time.hour       = 14;
+  time.minute     = 30;
+  time.sec        = 1;
+  time.resolution = MD_RES_SECONDS;
+  time.fraction   = 0;
+  w.append_time( F( "TRDTIM_1" ), time );
+  time.resolution = MD_RES_MINUTES;
+  w.append_time( F( "TIMACT" ), time );
+
+  date.year = 2026;
+  date.mon  = 10;
+  date.day  = 19;
+  w.append_date( F( "TRADE_DATE" ), date );
+  return w.update_hdr();
+}
+#undef F
+
+/* a msg captured to a file, the payload of a MSG without the trailer */
+static char *
+load_file( const char *fn,  size_t &len ) noexcept
+{
+  FILE * fp = ::fopen( fn, "rb" );
+  char * buf = NULL;
+  long   sz;
+  len = 0;
+  if ( fp == NULL ) {
+    perror( fn );
+    return NULL;
+  }
+  if ( ::fseek( fp, 0, SEEK_END ) == 0 && (sz = ::ftell( fp )) > 0 &&
+       ::fseek( fp, 0, SEEK_SET ) == 0 &&
+       (buf = (char *) ::malloc( sz )) != NULL ) {
+    if ( ::fread( buf, 1, sz, fp ) == (size_t) sz )
+      len = (size_t) sz;
+    else {
+      ::free( buf );
+      buf = NULL;
+    }
+  }
+  if ( buf == NULL )
+    fprintf( stderr, "%s: unable to read\n", fn );
+  ::fclose( fp );
+  return buf;
+}
+
+struct Result {
+  uint64_t ns,       /* time to unpack + convert */
+           reserved, /* bytes asked of the MDMsgMem */
+           json;     /* bytes of json */
+  uint32_t fail;
+};
+
+enum { RUN_RAIMD, RUN_FIXED, RUN_ESTIMATE };
+
+static void
+run( const char *msg,  size_t len,  uint32_t count,  int kind,
+     Result &r ) noexcept
+{
+  MDMsgMem    spc;
+  NatsXfCache cache;
+  char      * out;
+  size_t      out_len;
+  uint64_t    start = kv_current_monotonic_time_ns();
+
+  ::memset( &r, 0, sizeof( r ) );
+  for ( uint32_t i = 0; i < count; i++ ) {
+    spc.reuse();
+    MDMsg * m = MDMsg::unpack( (void *) msg, 0, len, 0, NULL, spc );
+    if ( m == NULL ) {
+      r.fail++;
+      continue;
+    }
+    if ( kind == RUN_RAIMD ) {
+      size_t max_len = ( ( len | 15 ) + 1 ) * 16;
+      JsonMsgWriter jmsg( spc, spc.str_make( max_len ), max_len );
+      if ( jmsg.convert_msg( *m ) != 0 || ! jmsg.finish() )
+        r.fail++;
+      r.reserved += max_len;
+      r.json     += jmsg.off;
+    }
+    else if ( kind == RUN_FIXED ) {
+      size_t max_len = ( ( len | 15 ) + 1 ) * 16;
+      NatsJsonWriter jmsg( spc, spc.str_make( max_len ), max_len );
+      if ( jmsg.convert_msg( *m ) != 0 || ! jmsg.finish() )
+        r.fail++;
+      r.reserved += max_len;
+      r.json     += jmsg.off;
+    }
+    else {
+      size_t est = cache.estimate( len );
+      uint64_t grows = cache.grows;
+      if ( ! cache.convert( *m, spc, len, NATS_ENC_JSON, out, out_len ) ) {
+        r.fail++;
+        out_len = 0;
+      }
+      /* each grow doubles, the earlier tries are not freed until reuse */
+      for ( ; grows < cache.grows; grows++ ) {
+        r.reserved += est;
+        est *= 2;
+      }
+      r.reserved += est;
+      r.json     += out_len;
+    }
+  }
+  r.ns = kv_current_monotonic_time_ns() - start;
+}
+
+static void
+report( const char *kind,  const Result &r,  uint32_t count ) noexcept
+{
+  double secs = (double) r.ns / 1e9;
+  printf( "  %-8s %10.0f msgs/sec %7.1f MB/sec json, reserve %6u/msg "
+          "json %5u/msg%s\n", kind,
+          (double) count / secs, (double) r.json / secs / ( 1024 * 1024 ),
+          (uint32_t) ( r.reserved / count ), (uint32_t) ( r.json / count ),
+          r.fail ? " (failures)" : "" );
+}
+
+int
+main( int argc, char **argv )
+{
+  const char * cn = get_arg( argc, argv, 1, "-n", "1000000" ),
+             * fn = get_arg( argc, argv, 1, "-f", 0 ),
+             * he = get_arg( argc, argv, 0, "-h", 0 );
+  if ( he != NULL ) {
+    fprintf( stderr,
+             "%s [-n count] [-f file]\n"
+             "  -n count = msgs converted per run (1000000)\n"
+             "  -f file  = also convert a captured RV or TIBMSG msg\n",
+             argv[ 0 ] );
+    return 1;
+  }
+  uint32_t count = (uint32_t) ::strtoul( cn, NULL, 0 );
+  if ( count == 0 )
+    count = 1;
+
+  MDMsgMem  mem;
+  char      rv_buf[ 4096 ], tib_buf[ 4096 ];
+  RvMsgWriter  rv( mem, rv_buf, sizeof( rv_buf ) );
+  TibMsgWriter tib( mem, tib_buf, sizeof( tib_buf ) );
+  size_t    rv_len  = make_quote( rv, 1 ),
+            tib_len = make_quote( tib, 1 );
+  struct {
+    const char * name, * msg;
+    size_t       len;
+  } payload[ 3 ] = { { "rv", rv_buf, rv_len },
+                     { "tibmsg", tib_buf, tib_len },
+                     { fn, NULL, 0 } };
+  int pcnt = 2;
+  if ( fn != NULL ) {
+    if ( (payload[ 2 ].msg = load_file( fn, payload[ 2 ].len )) == NULL )
+      return 1;
+    pcnt = 3;
+  }
+
+  for ( int i = 0; i < pcnt; i++ ) {
+    Result r;
+    printf( "%s %u bytes, %u conversions\n", payload[ i ].name,
+            (uint32_t) payload[ i ].len, count );
+    run( payload[ i ].msg, payload[ i ].len, count, RUN_RAIMD, r );
+    report( "raimd", r, count );
+    run( payload[ i ].msg, payload[ i ].len, count, RUN_FIXED, r );
+    report( "fixed", r, count );
+    run( payload[ i ].msg, payload[ i ].len, count, RUN_ESTIMATE, r );
+    report( "estimate", r, count );
+  }
+  return 0;
+}
@@ -0,0 +1,351 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <algorithm>
+
+/* fan out benchmark, subscribes one subject with -n sids, publishes -m msgs
+ * of -z bytes and counts the MSG frames delivered, which is msgs * sids;
+ * run against a server before and after a change to compare deliveries/sec:
+ *
+ *   nats_bench -p 42222 -n 10 -m 1000000 -z 128
+ *
+ * the payload starts with the time sent, the latency of sid 1 is sampled;
+ * the server varz is requested before and after to count the writes */
+
+static const char *
+get_arg( int argc, char *argv[], int b, const char *f, const char *def )
+{
+  for ( int i = 1; i < argc - b; i++ )
+    if ( ::strcmp( f, argv[ i ] ) == 0 )
+      return argv[ i + b ];
+  return def; /* default value */
+}
+
+static uint64_t
+current_ns( void )
+{
+  struct timespec ts;
+  ::clock_gettime( CLOCK_MONOTONIC, &ts );
+  return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+static int
+connect_to( const char *host,  const char *port )
+{
+  struct addrinfo hints, * ai, * p;
+  int fd = -1;
+  ::memset( &hints, 0, sizeof( hints ) );
+  hints.ai_family   = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if ( ::getaddrinfo( host, port, &hints, &ai ) != 0 )
+    return -1;
+  for ( p = ai; p != NULL; p = p->ai_next ) {
+    fd = ::socket( p->ai_family, p->ai_socktype, p->ai_protocol );
+    if ( fd < 0 )
+      continue;
+    if ( ::connect( fd, p->ai_addr, p->ai_addrlen ) == 0 )
+      break;
+    ::close( fd );
+    fd = -1;
+  }
+  ::freeaddrinfo( ai );
+  if ( fd >= 0 ) {
+    int on = 1;
+    ::setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof( on ) );
+    ::fcntl( fd, F_SETFL, ::fcntl( fd, F_GETFL ) | O_NONBLOCK );
+  }
+  return fd;
+}
+
+struct Bench {
+  int      fd;
+  char   * out;         /* PUB frames not yet written */
+  size_t   out_off,
+           out_len,
+           out_size;
+  char   * in;          /* partial frames read */
+  size_t   in_len,
+           in_size;
+  uint64_t delivered,   /* MSG frames received */
+           bytes,       /* payload bytes received */
+           pongs,
+         * lat,         /* latency of sid 1 msgs */
+           lat_cnt,
+           lat_max;
+  char   * varz;        /* last reply to VARZ */
+
+  Bench( int f ) : fd( f ), out( 0 ), out_off( 0 ), out_len( 0 ),
+    out_size( 0 ), in( 0 ), in_len( 0 ), in_size( 0 ), delivered( 0 ),
+    bytes( 0 ), pongs( 0 ), lat( 0 ), lat_cnt( 0 ), lat_max( 0 ),
+    varz( 0 ) {}
+
+  void queue( const void *p,  size_t len ) {
+    if ( this->out_len + len > this->out_size ) {
+      if ( this->out_off > 0 ) {
+        ::memmove( this->out, &this->out[ this->out_off ],
+                   this->out_len - this->out_off );
+        this->out_len -= this->out_off;
+        this->out_off  = 0;
+      }
+      while ( this->out_len + len > this->out_size )
+        this->out_size = ( this->out_size == 0 ? 64 * 1024 :
+                           this->out_size * 2 );
+      this->out = (char *) ::realloc( this->out, this->out_size );
+    }
+    ::memcpy( &this->out[ this->out_len ], p, len );
+    this->out_len += len;
+  }
+  bool flush( void ) {
+    while ( this->out_off < this->out_len ) {
+      ssize_t n = ::send( this->fd, &this->out[ this->out_off ],
+                          this->out_len - this->out_off, 0 );
+      if ( n <= 0 )
+        return n < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK );
+      this->out_off += (size_t) n;
+    }
+    this->out_off = this->out_len = 0;
+    return true;
+  }
+  bool read( void ) {
+    for (;;) {
+      if ( this->in_len == this->in_size ) {
+        this->in_size = ( this->in_size == 0 ? 256 * 1024 :
+                          this->in_size * 2 );
+        this->in = (char *) ::realloc( this->in, this->in_size );
+      }
+      ssize_t n = ::recv( this->fd, &this->in[ this->in_len ],
+                          this->in_size - this->in_len, 0 );
+      if ( n <= 0 ) {
+        if ( n < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) )
+          break;
+        return false;
+      }
+      this->in_len += (size_t) n;
+    }
+    this->parse();
+    return true;
+  }
+  /* count MSG frames, skip INFO, +OK, PONG, answer PING */
+  void parse( void ) {
+    size_t off = 0;
+    for (;;) {
+      char * line = &this->in[ off ],
+           * eol  = (char *) ::memchr( line, '\n', this->in_len - off );
+      if ( eol == NULL )
+        break;
+      size_t linesz = &eol[ 1 ] - line;
+      if ( linesz > 4 && ::memcmp( line, "MSG ", 4 ) == 0 ) {
+        char * p = eol;
+        while ( p > line && ( p[ -1 ] < '0' || p[ -1 ] > '9' ) )
+          p--;
+        while ( p > line && p[ -1 ] >= '0' && p[ -1 ] <= '9' )
+          p--;
+        size_t sz = (size_t) ::strtoull( p, NULL, 10 );
+        if ( off + linesz + sz + 2 > this->in_len )
+          break;
+        this->msg( line, linesz, &line[ linesz ], sz );
+        off += linesz + sz + 2;
+        continue;
+      }
+      if ( linesz >= 4 && ::memcmp( line, "PING", 4 ) == 0 )
+        this->queue( "PONG\r\n", 6 );
+      else if ( linesz >= 4 && ::memcmp( line, "PONG", 4 ) == 0 )
+        this->pongs++;
+      else if ( linesz >= 4 && ::memcmp( line, "-ERR", 4 ) == 0 )
+        fprintf( stderr, "%.*s", (int) linesz, line );
+      off += linesz;
+    }
+    if ( off > 0 ) {
+      ::memmove( this->in, &this->in[ off ], this->in_len - off );
+      this->in_len -= off;
+    }
+  }
+  /* MSG <subject> <sid> <size>, sid 0 is the varz inbox */
+  void msg( const char *line,  size_t linesz,  const char *data,
+            size_t sz ) {
+    const char * sid = (const char *) ::memchr( &line[ 4 ], ' ', linesz - 4 );
+    if ( sid != NULL && sid[ 1 ] == '0' && sid[ 2 ] == ' ' ) {
+      this->varz = (char *) ::realloc( this->varz, sz + 1 );
+      ::memcpy( this->varz, data, sz );
+      this->varz[ sz ] = '\0';
+      return;
+    }
+    this->delivered++;
+    this->bytes += sz;
+    if ( sid != NULL && sid[ 1 ] == '1' && sid[ 2 ] == ' ' && sz >= 20 &&
+         this->lat_cnt < this->lat_max ) {
+      uint64_t sent = ::strtoull( data, NULL, 10 );
+      this->lat[ this->lat_cnt++ ] = current_ns() - sent;
+    }
+  }
+  /* find "name":<number> in the varz reply */
+  uint64_t varz_val( const char *name ) {
+    char key[ 64 ];
+    ::snprintf( key, sizeof( key ), "\"%s\":", name );
+    const char * p = ( this->varz == NULL ? NULL :
+                       ::strstr( this->varz, key ) );
+    return p == NULL ? 0 : ::strtoull( &p[ ::strlen( key ) ], NULL, 10 );
+  }
+  bool wait( int ms ) {
+    struct pollfd pfd;
+    pfd.fd      = this->fd;
+    pfd.events  = POLLIN | ( this->out_off < this->out_len ? POLLOUT : 0 );
+    pfd.revents = 0;
+    if ( ::poll( &pfd, 1, ms ) < 0 )
+      return false;
+    if ( ( pfd.revents & POLLOUT ) != 0 && ! this->flush() )
+      return false;
+    if ( ( pfd.revents & ( POLLIN | POLLHUP ) ) != 0 && ! this->read() )
+      return false;
+    return true;
+  }
+};
+
+/* PUB $SYS.REQ.SERVER.VARZ, wait for the reply */
+static bool
+request_varz( Bench &b )
+{
+  char buf[ 128 ];
+  int  n = ::snprintf( buf, sizeof( buf ),
+                       "PUB $SYS.REQ.SERVER.VARZ _INBOX.bench.%u 0\r\n\r\n",
+                       (uint32_t) ::getpid() );
+  if ( b.varz != NULL )
+    b.varz[ 0 ] = '\0';
+  b.queue( buf, n );
+  b.queue( "PING\r\n", 6 );
+  uint64_t pongs = b.pongs;
+  while ( b.pongs == pongs )
+    if ( ! b.wait( 1000 ) )
+      return false;
+  /* the reply is published on the bus, may arrive after PONG */
+  for ( int i = 0; i < 10 && ( b.varz == NULL || b.varz[ 0 ] == '\0' ); i++ )
+    if ( ! b.wait( 10 ) )
+      return false;
+  return true;
+}
+
+int
+main( int argc, char **argv )
+{
+  const char * ho = get_arg( argc, argv, 1, "-s", "localhost" ),
+             * po = get_arg( argc, argv, 1, "-p", "42222" ),
+             * ns = get_arg( argc, argv, 1, "-n", "10" ),
+             * nm = get_arg( argc, argv, 1, "-m", "1000000" ),
+             * nz = get_arg( argc, argv, 1, "-z", "128" ),
+             * su = get_arg( argc, argv, 1, "-t", "bench.fanout" ),
+             * us = get_arg( argc, argv, 1, "-u", "sys" ),
+             * pw = get_arg( argc, argv, 1, "-w", "" ),
+             * he = get_arg( argc, argv, 0, "-h", 0 );
+  if ( he != NULL ) {
+    fprintf( stderr,
+             "%s [-s host] [-p port] [-n sids] [-m msgs] [-z size] [-t subj]\n"
+             "   [-u user] [-w pass]\n"
+             "  -s host = server host (localhost)\n"
+             "  -p port = server port (42222)\n"
+             "  -n sids = number of sids subscribed to the subject (10)\n"
+             "  -m msgs = number of msgs published (1000000)\n"
+             "  -z size = size of each msg payload (128)\n"
+             "  -t subj = subject published (bench.fanout)\n"
+             "  -u user = NATSMD_SYS_USER of the server, for VARZ (sys)\n"
+             "  -w pass = NATSMD_SYS_PASS of the server ()\n", argv[ 0 ] );
+    return 1;
+  }
+  uint64_t sids  = ::strtoull( ns, NULL, 10 ),
+           msgs  = ::strtoull( nm, NULL, 10 ),
+           size  = ::strtoull( nz, NULL, 10 ),
+           total = sids * msgs;
+  int      fd    = connect_to( ho, po );
+  if ( fd < 0 ) {
+    fprintf( stderr, "connect %s:%s failed\n", ho, po );
+    return 1;
+  }
+  Bench b( fd );
+  char   buf[ 1024 ];
+  int    n;
+  n = ::snprintf( buf, sizeof( buf ),
+                  "CONNECT {\"verbose\":false,\"echo\":true,"
+                  "\"user\":\"%s\",\"pass\":\"%s\"}\r\n", us, pw );
+  b.queue( buf, n );
+  for ( uint64_t i = 1; i <= sids; i++ ) {
+    n = ::snprintf( buf, sizeof( buf ), "SUB %s %u\r\n", su, (uint32_t) i );
+    b.queue( buf, n );
+  }
+  n = ::snprintf( buf, sizeof( buf ), "SUB _INBOX.bench.%u 0\r\n",
+                  (uint32_t) ::getpid() );
+  b.queue( buf, n );
+  if ( ! request_varz( b ) )
+    return 1;
+  uint64_t out_msgs    = b.varz_val( "out_msgs" ),
+           write_calls = b.varz_val( "write_calls" );
+  b.lat_max = msgs;
+  b.lat     = (uint64_t *) ::malloc( sizeof( uint64_t ) * ( msgs + 1 ) );
+
+  char * msg = (char *) ::malloc( size + 2 );
+  ::memset( msg, 'x', size );
+  ::memcpy( &msg[ size ], "\r\n", 2 );
+  n = ::snprintf( buf, sizeof( buf ), "PUB %s %u\r\n", su, (uint32_t) size );
+
+  uint64_t start = current_ns(), pub = 0, last = start;
+  while ( b.delivered < total ) {
+    /* keep a window of msgs in flight so that the server is not idle */
+    while ( pub < msgs && ( pub - b.delivered / ( sids ? sids : 1 ) ) < 1000 &&
+            b.out_len - b.out_off < 1024 * 1024 ) {
+      if ( size >= 20 ) {
+        char stamp[ 24 ];
+        ::snprintf( stamp, sizeof( stamp ), "%020llu",
+                    (unsigned long long) current_ns() );
+        ::memcpy( msg, stamp, 20 );
+      }
+      b.queue( buf, n );
+      b.queue( msg, size + 2 );
+      pub++;
+    }
+    if ( ! b.flush() || ! b.wait( 1000 ) ) {
+      fprintf( stderr, "connection closed\n" );
+      break;
+    }
+    uint64_t now = current_ns();
+    if ( now - last >= 5000000000ULL ) {
+      fprintf( stderr, "%llu of %llu delivered\n",
+               (unsigned long long) b.delivered, (unsigned long long) total );
+      last = now;
+    }
+  }
+  double secs = (double) ( current_ns() - start ) / 1000000000.0;
+  printf( "sids %llu msgs %llu size %llu: %llu deliveries in %.3f secs, "
+          "%.0f deliveries/sec, %.1f MB/sec\n",
+          (unsigned long long) sids, (unsigned long long) msgs,
+          (unsigned long long) size, (unsigned long long) b.delivered, secs,
+          (double) b.delivered / secs,
+          (double) b.bytes / secs / ( 1024.0 * 1024.0 ) );
+  if ( b.lat_cnt > 0 ) {
+    std::sort( b.lat, &b.lat[ b.lat_cnt ] );
+    printf( "latency usecs p50 %.1f p99 %.1f p999 %.1f max %.1f\n",
+            (double) b.lat[ b.lat_cnt / 2 ] / 1000.0,
+            (double) b.lat[ b.lat_cnt * 99 / 100 ] / 1000.0,
+            (double) b.lat[ b.lat_cnt * 999 / 1000 ] / 1000.0,
+            (double) b.lat[ b.lat_cnt - 1 ] / 1000.0 );
+  }
+  if ( request_varz( b ) ) {
+    out_msgs    = b.varz_val( "out_msgs" ) - out_msgs;
+    write_calls = b.varz_val( "write_calls" ) - write_calls;
+    if ( write_calls > 0 )
+      printf( "server out_msgs %llu write_calls %llu, %.2f msgs per write\n",
+              (unsigned long long) out_msgs, (unsigned long long) write_calls,
+              (double) out_msgs / (double) write_calls );
+  }
+  ::free( b.lat );
+  ::free( msg );
+  ::close( fd );
+  return 0;
+}
@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#define __STDC_FORMAT_MACROS
+#include <inttypes.h>
+#include <natsmd/nats_trace.h>
+
+using namespace rai;
+using namespace natsmd;
+
+/* convert a trace ring written by nats_trace_dump() into:
+ *   folded stacks, "process;fwd_pub;on_msg;fwd_msg <ns>", the input of
+ *     flamegraph.pl, the value is the self time of the stack, or
+ *   chrome trace event json (-j), a timeline for perfetto or speedscope */
+
+static const char *
+get_arg( int argc, char *argv[], int b, const char *f, const char *def )
+{
+  for ( int i = 1; i < argc - b; i++ )
+    if ( ::strcmp( f, argv[ i ] ) == 0 )
+      return argv[ i + b ];
+  return def; /* default value */
+}
+
+static const size_t MAX_DEPTH = 16;
+
+struct Frame {
+  uint64_t start,  /* enter time */
+           child;  /* time spent in children */
+  uint16_t point;
+};
+
+struct Folded {
+  uint64_t ns;     /* self time of stack */
+  uint32_t depth;
+  uint16_t stack[ MAX_DEPTH ];
+};
+
+static Folded * folded;
+static size_t   folded_cnt, folded_max;
+
+static void
+add_folded( const Frame *f,  size_t depth,  uint64_t ns ) noexcept
+{
+  size_t i, j;
+  for ( i = 0; i < folded_cnt; i++ ) {
+    if ( folded[ i ].depth != depth )
+      continue;
+    for ( j = 0; j < depth; j++ )
+      if ( folded[ i ].stack[ j ] != f[ j ].point )
+        break;
+    if ( j == depth ) {
+      folded[ i ].ns += ns;
+      return;
+    }
+  }
+  if ( folded_cnt == folded_max ) {
+    folded_max = ( folded_max == 0 ? 64 : folded_max * 2 );
+    folded = (Folded *) ::realloc( folded, sizeof( Folded ) * folded_max );
+  }
+  Folded & x = folded[ folded_cnt++ ];
+  x.ns    = ns;
+  x.depth = (uint32_t) depth;
+  for ( j = 0; j < depth; j++ )
+    x.stack[ j ] = f[ j ].point;
+}
+
+int
+main( int argc, char **argv )
+{
+  const char * js = get_arg( argc, argv, 0, "-j", 0 ),
+             * he = get_arg( argc, argv, 0, "-h", 0 ),
+             * fn = ( argc > 1 ? argv[ argc - 1 ] : NULL );
+  NatsTraceFileHdr hdr;
+  NatsTraceRec     rec;
+  Frame            stack[ MAX_DEPTH ];
+  size_t           depth = 0, skipped = 0;
+  uint64_t         first = 0;
+  bool             comma = false;
+
+  if ( he != NULL || fn == NULL || fn[ 0 ] == '-' ) {
+    fprintf( stderr,
+             "%s [-j] trace-file\n"
+             "  -j         = output chrome trace json instead of folded\n"
+             "  trace-file = natsmd_trace.<pid>.<id> from TRACE dump\n",
+             argv[ 0 ] );
+    return 1;
+  }
+  FILE * fp = ::fopen( fn, "rb" );
+  if ( fp == NULL ) {
+    ::perror( fn );
+    return 1;
+  }
+  if ( ::fread( &hdr, sizeof( hdr ), 1, fp ) != 1 ||
+       ::memcmp( hdr.magic, NATS_TRACE_MAGIC, sizeof( hdr.magic ) ) != 0 ||
+       hdr.rec_size != sizeof( NatsTraceRec ) ) {
+    fprintf( stderr, "%s: not a natsmd trace file\n", fn );
+    ::fclose( fp );
+    return 1;
+  }
+  if ( hdr.lost != 0 )
+    fprintf( stderr, "%" PRIu64 " records lost before the dump\n", hdr.lost );
+  if ( js != NULL )
+    printf( "{\"traceEvents\":[\n" );
+
+  for ( uint32_t i = 0; i < hdr.count; i++ ) {
+    if ( ::fread( &rec, sizeof( rec ), 1, fp ) != 1 )
+      break;
+    if ( first == 0 )
+      first = rec.ns;
+    if ( js != NULL ) {
+      printf( "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,"
+              "\"tid\":%u,\"args\":{\"arg\":%u}}",
+              comma ? ",\n" : "", nats_trace_point_name( rec.point ),
+              rec.type == NATS_TR_ENTER ? 'B' : 'E',
+              (double) ( rec.ns - first ) / 1000.0, hdr.id, rec.arg );
+      comma = true;
+      continue;
+    }
+    if ( rec.type == NATS_TR_ENTER ) {
+      if ( depth == MAX_DEPTH ) {
+        skipped++;
+        continue;
+      }
+      stack[ depth ].start = rec.ns;
+      stack[ depth ].child = 0;
+      stack[ depth ].point = rec.point;
+      depth++;
+    }
+    else {
+      /* the ring may start inside a scope, skip exits without enter */
+      if ( depth == 0 || stack[ depth - 1 ].point != rec.point ) {
+        skipped++;
+        continue;
+      }
+      uint64_t dur  = rec.ns - stack[ depth - 1 ].start,
+               self = dur - stack[ depth - 1 ].child;
+      add_folded( stack, depth, self );
+      depth--;
+      if ( depth > 0 )
+        stack[ depth - 1 ].child += dur;
+    }
+  }
+  ::fclose( fp );
+
+  if ( js != NULL ) {
+    printf( "\n]}\n" );
+    return 0;
+  }
+  for ( size_t i = 0; i < folded_cnt; i++ ) {
+    for ( uint32_t j = 0; j < folded[ i ].depth; j++ )
+      printf( "%s%s", j > 0 ? ";" : "",
+              nats_trace_point_name( folded[ i ].stack[ j ] ) );
+    printf( " %" PRIu64 "\n", folded[ i ].ns );
+  }
+  if ( skipped > 0 )
+    fprintf( stderr, "%u records skipped\n", (uint32_t) skipped );
+  return 0;
+}
@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <raikv/key_hash.h>
+#include <raikv/util.h>
+#include <natsmd/ev_nats.h>
+#include <natsmd/nats_proj.h>
+#include <natsmd/nats_json.h>
+#include <raimd/rv_msg.h>
+#include <raimd/tib_msg.h>
+
+using namespace rai;
+using namespace kv;
+using namespace natsmd;
+using namespace md;
+
+/* projections and delta images of rv msgs, a session:
+ *
+ *   msg BID=1.5 ASK=1.6 SYM=IBM
+ *   proj {BID,SYM} rv # BID and SYM, converted back to json to print
+ *   delta k           # the first is full, all three
+ *   msg BID=1.7 ASK=1.6
+ *   delta k           # BID only, ASK is unchanged
+ *   msg ASK=1.8
+ *   delta k           # ASK only
+ *   delta k full      # ASK from the msg, BID and SYM from the image
+ *   drop k
+ */
+
+static size_t
+get_args( char *buf,  char **args,  size_t *arglen,  size_t maxargs ) noexcept
+{
+  char * end = &buf[ ::strlen( buf ) ];
+  size_t argc = 0;
+  for (;;) {
+    while ( buf < end && *buf <= ' ' )
+      buf++;
+    if ( buf == end || argc == maxargs )
+      break;
+    args[ argc ] = buf;
+    while ( buf < end && *buf > ' ' )
+      buf++;
+    arglen[ argc ] = buf - args[ argc ];
+    argc++;
+  }
+  return argc;
+}
+
+/* <name>=<value>, an int if digits, a real if it has a dot, or a string,
+ * returns the msg size, zero if an arg is bad */
+static size_t
+make_msg( RvMsgWriter &w,  char **args,  size_t *arglen,
+          size_t argc ) noexcept
+{
+  for ( size_t i = 1; i < argc; i++ ) {
+    char * eq = (char *) ::memchr( args[ i ], '=', arglen[ i ] );
+    if ( eq == NULL )
+      return 0;
+    size_t fname_len = eq - args[ i ],
+           val_len   = arglen[ i ] - ( fname_len + 1 );
+    char   fname[ 256 ], val[ 256 ], * end;
+    if ( fname_len >= sizeof( fname ) || val_len >= sizeof( val ) )
+      return 0;
+    ::memcpy( fname, args[ i ], fname_len );
+    fname[ fname_len ] = '\0';
+    ::memcpy( val, &eq[ 1 ], val_len );
+    val[ val_len ] = '\0';
+    int64_t ival = ::strtoll( val, &end, 10 );
+    if ( val_len > 0 && *end == '\0' )
+      w.append_int( fname, fname_len + 1, ival );
+    else if ( ::strchr( val, '.' ) != NULL && ::strtod( val, &end ) != 0 &&
+              *end == '\0' )
+      w.append_real( fname, fname_len + 1, ::strtod( val, NULL ) );
+    else
+      w.append_string( fname, fname_len + 1, val, val_len + 1 );
+  }
+  size_t len = w.update_hdr();
+  return w.err == 0 ? len : 0;
+}
+
+/* print the msg as json, rv and tibmsg are converted */
+static void
+print_msg( const char *what,  const char *out,  size_t out_len,
+           MDMsgMem &spc ) noexcept
+{
+  if ( out_len > 0 && out[ 0 ] == '{' ) {
+    printf( "%s %.*s\n", what, (int) out_len, out );
+    return;
+  }
+  MDMsg * m = MDMsg::unpack( (void *) out, 0, out_len, 0, NULL, spc );
+  char    buf[ 4096 ];
+  NatsJsonWriter jmsg( spc, buf, sizeof( buf ) );
+  if ( m == NULL || jmsg.convert_msg( *m ) != 0 || ! jmsg.finish() )
+    printf( "%s unpack failed (%u bytes)\n", what, (uint32_t) out_len );
+  else
+    printf( "%s %.*s\n", what, (int) jmsg.off, jmsg.buf );
+}
+
+int
+main( void )
+{
+  NatsImageTab    tab;
+  NatsFieldImage * img;
+  RouteLoc        loc;
+  MDMsgMem        spc;
+  char            buf[ 1024 ],
+                  msg_buf[ 4096 ];
+  char          * args[ 16 ],
+                * out;
+  size_t          argc, arglen[ 16 ],
+                  msg_len = 0,
+                  out_len;
+  uint8_t         enc;
+  uint32_t        h;
+
+  for (;;) {
+    if ( 0 ) {
+    help:;
+      printf( "msg <name>=<value> ...\n"
+              "proj {F1,F2,...} [json|rv|tibmsg|raw]\n"
+              "delta <key> [full]\n"
+              "drop <key>\nq\n" );
+    }
+    if ( fgets( buf, sizeof( buf ), stdin ) == NULL )
+      break;
+    if ( buf[ 0 ] == '#' || buf[ 0 ] == '\n' )
+      continue;
+    argc = get_args( buf, args, arglen, 16 );
+    if ( argc == 1 && buf[ 0 ] == 'q' )
+      break;
+    if ( argc == 0 )
+      goto help;
+    spc.reuse();
+    switch ( args[ 0 ][ 0 ] ) {
+      case 'm': { /* msg <name>=<value> ... */
+        RvMsgWriter w( spc, msg_buf, sizeof( msg_buf ) );
+        msg_len = ( argc < 2 ? 0 : make_msg( w, args, arglen, argc ) );
+        if ( msg_len == 0 )
+          goto help;
+        printf( "msg %u bytes\n", (uint32_t) msg_len );
+        break;
+      }
+      case 'p': { /* proj {F1,F2} [enc] */
+        if ( argc < 2 || argc > 3 || msg_len == 0 )
+          goto help;
+        NatsFieldList * fl = NatsFieldList::create( args[ 1 ], arglen[ 1 ] );
+        if ( fl == NULL ) {
+          printf( "bad field list\n" );
+          break;
+        }
+        enc = NATS_ENC_JSON;
+        if ( argc == 3 ) {
+          if ( args[ 2 ][ 0 ] == 'r' && arglen[ 2 ] == 2 )
+            enc = NATS_ENC_RV;
+          else if ( args[ 2 ][ 0 ] == 't' )
+            enc = NATS_ENC_TIBMSG;
+          else if ( args[ 2 ][ 0 ] == 'r' )
+            enc = NATS_ENC_RAW;
+        }
+        if ( nats_project( spc, msg_buf, msg_len, RVMSG_TYPE_ID, enc, *fl,
+                           out, out_len ) )
+          print_msg( "proj", out, out_len, spc );
+        else
+          printf( "proj failed\n" );
+        ::free( fl );
+        break;
+      }
+      case 'd': /* delta <key> [full], drop <key> */
+        if ( argc < 2 || argc > 3 )
+          goto help;
+        h = kv_crc_c( args[ 1 ], arglen[ 1 ], 0 );
+        if ( args[ 0 ][ 1 ] == 'r' ) {
+          if ( (img = tab.find( h, args[ 1 ], arglen[ 1 ] )) != NULL ) {
+            if ( img->buf != NULL )
+              ::free( img->buf );
+            tab.remove( h, args[ 1 ], arglen[ 1 ] );
+          }
+          printf( "images %u\n", (uint32_t) tab.pop_count() );
+          break;
+        }
+        if ( msg_len == 0 )
+          goto help;
+        img = tab.upsert( h, args[ 1 ], arglen[ 1 ], loc );
+        if ( loc.is_new ) {
+          img->buf        = NULL;
+          img->used       = 0;
+          img->buf_len    = 0;
+          img->buf_size   = 0;
+          img->update_cnt = 0;
+          img->full_len   = 0;
+        }
+        if ( nats_delta( spc, msg_buf, msg_len, *img, argc == 3, out,
+                         out_len ) ) {
+          print_msg( "delta", out, out_len, spc );
+          printf( "image %u bytes\n", img->buf_len );
+        }
+        else
+          printf( "delta failed\n" );
+        break;
+      default:
+        goto help;
+    }
+  }
+  for ( img = tab.first( loc ); img != NULL; img = tab.next( loc ) ) {
+    if ( img->buf != NULL )
+      ::free( img->buf );
+  }
+  tab.release();
+  return 0;
+}
@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <natsmd/ev_nats_client.h>
+
+using namespace rai;
+using namespace natsmd;
+
+/* the prefix trie of the client wildcards, a session which checks itself:
+ *
+ *   add 1             # the empty prefix, matches everything
+ *   add 2 RSF.
+ *   add 3 RSF.REC.
+ *   add 4 RSF.RE
+ *   chk 4 RSF.REC.IBM # the max sid of RSF.RE and RSF.REC.
+ *   chk 4 RSF.RED
+ *   chk 1 RSG
+ *   rem RSF.RE        # shared by RSF.REC., which stays
+ *   chk 3 RSF.REC.IBM
+ *   chk 2 RSF.RED
+ *   rem RSF.REC.
+ *   rem
+ *   chk 2 RSF.X
+ *   chk 0 RSG
+ *   rem RSF.
+ *   nodes             # all free except the root
+ */
+
+static size_t
+get_args( char *buf,  char **args,  size_t *arglen,  size_t maxargs ) noexcept
+{
+  char * end = &buf[ ::strlen( buf ) ];
+  size_t argc = 0;
+  for (;;) {
+    while ( buf < end && *buf <= ' ' )
+      buf++;
+    if ( buf == end || argc == maxargs )
+      break;
+    args[ argc ] = buf;
+    while ( buf < end && *buf > ' ' )
+      buf++;
+    arglen[ argc ] = buf - args[ argc ];
+    argc++;
+  }
+  return argc;
+}
+
+static uint32_t
+free_count( const NatsPrefixTrie &trie ) noexcept
+{
+  uint32_t cnt = 0;
+  for ( uint32_t n = trie.free_list; n != 0; n = trie.node[ n ].sibling )
+    cnt++;
+  return cnt;
+}
+
+int
+main( void )
+{
+  NatsPrefixTrie trie;
+  char           buf[ 1024 ];
+  char         * args[ 4 ];
+  size_t         argc, arglen[ 4 ];
+  uint32_t       sid, max;
+  int            fail = 0;
+
+  for (;;) {
+    if ( 0 ) {
+    help:;
+      printf( "add <sid> [prefix]\n"
+              "rem [prefix]\n"
+              "max <subject>\n"
+              "chk <sid> <subject>\n"
+              "nodes\nq\n" );
+    }
+    if ( fgets( buf, sizeof( buf ), stdin ) == NULL )
+      break;
+    if ( buf[ 0 ] == '#' || buf[ 0 ] == '\n' )
+      continue;
+    argc = get_args( buf, args, arglen, 3 );
+    if ( argc == 0 )
+      goto help;
+    switch ( args[ 0 ][ 0 ] ) {
+      case 'a': /* add <sid> [prefix] */
+        if ( argc < 2 )
+          goto help;
+        sid = (uint32_t) ::strtoul( args[ 1 ], NULL, 0 );
+        if ( ! trie.add( argc == 3 ? args[ 2 ] : "",
+                         argc == 3 ? arglen[ 2 ] : 0, sid ) )
+          printf( "add failed\n" );
+        break;
+      case 'r': /* rem [prefix] */
+        trie.remove( argc == 2 ? args[ 1 ] : "", argc == 2 ? arglen[ 1 ] : 0 );
+        break;
+      case 'm': /* max <subject> */
+        if ( argc != 2 )
+          goto help;
+        printf( "%u\n", trie.max_sid( args[ 1 ], arglen[ 1 ] ) );
+        break;
+      case 'c': /* chk <sid> <subject> */
+        if ( argc != 3 )
+          goto help;
+        sid = (uint32_t) ::strtoul( args[ 1 ], NULL, 0 );
+        max = trie.max_sid( args[ 2 ], arglen[ 2 ] );
+        if ( max != sid ) {
+          printf( "FAIL %.*s = %u, expected %u\n", (int) arglen[ 2 ],
+                  args[ 2 ], max, sid );
+          fail++;
+        }
+        break;
+      case 'n': /* nodes */
+        printf( "nodes %u free %u root cnt %u\n", trie.node_cnt,
+                free_count( trie ),
+                trie.node_cnt == 0 ? 0 : trie.node[ 0 ].cnt );
+        break;
+      case 'q':
+        goto done;
+      default:
+        goto help;
+    }
+  }
+done:;
+  trie.release();
+  printf( "%d failed\n", fail );
+  return fail == 0 ? 0 : 1;
+}